@@ -0,0 +1,102 @@
+/**
+ * @file blob.hpp
+ * @brief out of line storage for large values
+ *
+ * values above the blob threshold of a leaf are written to a chain of blob
+ * pages, the leaf only keeps a BlobRef with the first page and the length.
+ * the length field of the leaf record has BlobRef::flag set. readers walk the
+ * chain chunk by chunk, a value is never assembled in a temporary buffer.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+struct BlobPage
+{
+    BlobPage *next;
+    uint32_t length;
+    alignas(8) uint8_t data[];
+
+    static constexpr unsigned headerSize = 16;
+    static constexpr unsigned pageSize = 4096;
+    static constexpr unsigned capacity = pageSize - headerSize;
+
+    // writes the value to a new chain of pages from the allocator of the tree, returns its first page
+    template <class Pages>
+    static BlobPage *write(Pages &pages, const uint8_t *value, uint64_t length)
+    {
+        static_assert(offsetof(BlobPage, data) == headerSize, "header does not match headerSize");
+        BlobPage *first = nullptr;
+        BlobPage **link = &first;
+        for (uint64_t done = 0; done < length;)
+        {
+            BlobPage *page = static_cast<BlobPage *>(pages.allocate(pageSize));
+            page->next = nullptr;
+            page->length = length - done < capacity ? length - done : capacity;
+            memcpy(page->data, value + done, page->length);
+            done += page->length;
+            *link = page;
+            link = &page->next;
+        }
+        return first;
+    }
+
+    template <class Pages>
+    static void release(Pages &pages, BlobPage *page)
+    {
+        while (page)
+        {
+            BlobPage *next = page->next;
+            pages.release(page, pageSize);
+            page = next;
+        }
+    }
+};
+
+// what a leaf stores in place of a blob value
+struct BlobRef
+{
+    BlobPage *first;
+    uint64_t length;
+
+    // marks the length field of a leaf record whose payload is a BlobRef
+    static constexpr uint64_t flag = uint64_t(1) << 63;
+};
+
+/**
+ * @brief a value in a leaf, either inline (data) or a chain of blob pages.
+ * only valid until the next write to the tree
+ */
+struct ValueView
+{
+    uint8_t *data;
+    BlobPage *blob;
+    uint64_t length;
+
+    bool isBlob() const { return data == nullptr; }
+
+    // calls fn(chunk, chunkLength) for the pieces of the value in order
+    template <class Fn>
+    void forEachChunk(Fn fn) const
+    {
+        if (data)
+        {
+            fn(data, length);
+            return;
+        }
+        for (BlobPage *page = blob; page; page = page->next)
+            fn(page->data, page->length);
+    }
+
+    void copyTo(uint8_t *out) const
+    {
+        forEachChunk([&](uint8_t *chunk, uint64_t chunkLength)
+                     {
+                         memcpy(out, chunk, chunkLength);
+                         out += chunkLength; });
+    }
+};
@@ -7,90 +7,459 @@
  */
 
 #include "btree.hpp"
-#include "../common.h"
-bool cont;
+HeadStats headStats;
 int split = 0;
-BTree::BTree()
-    : root(BTreeNode::makeLeaf()) {}
-bool BTree::lookup(u8 *key, unsigned keyLength, u64 &payloadLength, u8 *result)
+template <class Config>
+BTreeT<Config>::BTreeT()
+    : root(BTreeNode::makeLeaf(pages)) {}
+template <class Config>
+bool BTreeT<Config>::lookup(u8 *key, unsigned keyLength, ValueView &value)
 {
    BTreeNode *node = root;
    while (node->isInner())
       node = node->lookupInner(key, keyLength);
-   int pos = node->lowerBound<true>(key, keyLength);
-
-   if (pos != -1)
+   int pos = node->template search<true>(key, keyLength);
+   if (pos == -1)
+      return false;
+   value = node->getValueView(pos);
+   return true;
+}
+template <class Config>
+void BTreeT<Config>::insert(u8 *key, unsigned keyLength, u64 payloadLength, u8 *payload)
+{
+   if (!BTreeNode::acceptsPayload(payloadLength))
+      throw std::invalid_argument("payload length does not fit the leaf record format");
+   if (payloadLength <= BTreeNode::blobThreshold)
+      return insertRecord(key, keyLength, payloadLength, payload);
+   // the leaf only gets the reference to the blob pages
+   BlobRef ref{BlobPage::write(pages, payload, payloadLength), payloadLength};
+   insertRecord(key, keyLength, sizeof(BlobRef) | BTreeNode::blobFlag, reinterpret_cast<u8 *>(&ref));
+}
+template <class Config>
+void BTreeT<Config>::insertRecord(u8 *key, unsigned keyLength, u64 lengthField, u8 *payload)
+{
+   BTreeNode *path[maxHeight];
+   unsigned positions[maxHeight];
+   unsigned depth = 0;
+   BTreeNode *node = findLeaf(key, keyLength, path, positions, depth);
+   assert(node->isSorted());
+   if (node->insert(key, keyLength, SwipType(lengthField), payload))
+      return addRecords(path, positions, depth, 1);
+   splitNode(node, depth ? path[depth - 1] : nullptr, key, keyLength);
+   insertRecord(key, keyLength, lengthField, payload);
+}
+// every leaf has the same depth, so a group descends in lock step. each level is three passes over
+// the group: prefetch the search lines, search and prefetch the record with the child, follow the
+// child and prefetch its header. while one lookup waits the misses of the others are in flight
+template <class Config>
+unsigned BTreeT<Config>::lookupBatch(u8 *const *keys, const u16 *keyLengths, unsigned n, ValueView *values)
+{
+   unsigned found = 0;
+   for (unsigned begin = 0; begin < n; begin += batchGroup)
    {
-      payloadLength = u64(node->getChild(pos));
-      if (node->isLarge(pos))
+      unsigned group = min(batchGroup, n - begin);
+      BTreeNode *nodes[batchGroup] = {};
+      for (unsigned i = 0; i < group; i++)
+         nodes[i] = root;
+      while (nodes[0]->isInner())
       {
-         memcpy(result, node->getPayloadLarge(pos), node->getPayloadLength(pos)); 
+         for (unsigned i = 0; i < group; i++)
+            nodes[i]->prefetchSearch();
+         unsigned childPos[batchGroup];
+         for (unsigned i = 0; i < group; i++)
+         {
+            childPos[i] = nodes[i]->lookupInnerPos(keys[begin + i], keyLengths[begin + i]);
+            if (childPos[i] < nodes[i]->count)
+               nodes[i]->prefetchRecord(childPos[i]);
+         }
+         for (unsigned i = 0; i < group; i++)
+         {
+            nodes[i] = childPos[i] < nodes[i]->count ? nodes[i]->getChild(childPos[i]) : nodes[i]->upper;
+            __builtin_prefetch(nodes[i]);
+            __builtin_prefetch(reinterpret_cast<u8 *>(nodes[i]) + 64);
+         }
       }
-      else
+      for (unsigned i = 0; i < group; i++)
+         nodes[i]->prefetchSearch();
+      int pos[batchGroup];
+      for (unsigned i = 0; i < group; i++)
       {
-         memcpy(result, node->getPayload(pos), node->getPayloadLength(pos));
+         pos[i] = nodes[i]->template search<true>(keys[begin + i], keyLengths[begin + i]);
+         if (pos[i] != -1)
+            nodes[i]->prefetchRecord(pos[i]);
+      }
+      for (unsigned i = 0; i < group; i++)
+      {
+         values[begin + i] = pos[i] != -1 ? nodes[i]->getValueView(pos[i]) : ValueView{nullptr, nullptr, 0};
+         found += pos[i] != -1;
       }
-      return true;
    }
-   return false;
+   return found;
 }
 
-u64 BTree::getPayloadLenLookup(u8 *key, unsigned keyLength)
+/**
+ * @brief one level of a bulk load. takes the records of the level in key order and writes them
+ * into nodes packed to the budget, with the separators between the nodes for the level above.
+ * leaves end at the shortest separator above their last key, an inner node ends with the child
+ * of its last item as upper and the key of that item moves up. whether a record fits is first
+ * estimated with the prefix the lower fence shares with the keys so far, the upper fence of
+ * the node can only shorten that prefix, so the node is checked exactly when it is closed and
+ * gives its last items to the next node if they do not fit
+ */
+template <class Config>
+struct BulkLevel
 {
-   BTreeNode *node = root;
-   while (node->isInner())
-      node = node->lookupInner(key, keyLength);
-   int pos = node->lowerBound<true>(key, keyLength);
-   if (pos != -1)
+   using BTreeNode = BTreeNodeT<Config>;
+   using SwipType = typename BTreeNode::SwipType;
+   // a record waiting for its node, key and payload are copied to bytes
+   struct Item
+   {
+      size_t key;
+      unsigned keyLength;
+      u64 lengthField;
+      size_t payload;
+      BTreeNode *child;
+   };
+
+   typename BTreeNode::Pages &pages;
+   bool isLeaf;
+   unsigned pageSize;
+   unsigned budget;
+   std::vector<u8> bytes;
+   std::vector<Item> items;
+   // lower fence of the node being filled, empty for the first node of the level
+   std::vector<u8> lower;
+   // the estimate: prefix of lower and the keys of the items, bytes of the items with it
+   unsigned prefix = 0;
+   unsigned used = 0;
+   std::vector<BTreeNode *> nodes;
+   std::vector<std::vector<u8>> seps;
+
+   BulkLevel(typename BTreeNode::Pages &pages, bool isLeaf, double fillFactor)
+       : pages(pages), isLeaf(isLeaf), pageSize(isLeaf ? BTreeNode::leafPageSize : BTreeNode::innerPageSize),
+         budget(min(1.0, fillFactor) * pageSize) {}
+
+   static unsigned commonPrefix(const u8 *a, unsigned aLength, const u8 *b, unsigned bLength)
+   {
+      unsigned n = 0;
+      while (n < min(aLength, bLength) && a[n] == b[n])
+         n++;
+      return n;
+   }
+
+   u8 *keyOf(unsigned i) { return bytes.data() + items[i].key; }
+   // an inner node needs one item for its upper besides its records
+   unsigned minItems() { return isLeaf ? 1 : 2; }
+   unsigned records(unsigned n) { return isLeaf ? n : n - 1; }
+
+   // the estimated bytes of the items once key joins them
+   unsigned grow(const u8 *key, unsigned keyLength, u64 lengthField, unsigned &keyPrefix)
+   {
+      keyPrefix = min(prefix, commonPrefix(lower.data(), lower.size(), key, keyLength));
+      return used + items.size() * (prefix - keyPrefix) + BTreeNode::bulkRecordSpace(isLeaf, keyLength, lengthField, keyPrefix);
+   }
+
+   void push(const u8 *key, unsigned keyLength, u64 lengthField, const u8 *payload, BTreeNode *child)
    {
-      if (node->isLarge(pos))
+      unsigned keyPrefix;
+      used = grow(key, keyLength, lengthField, keyPrefix);
+      prefix = keyPrefix;
+      Item item{bytes.size(), keyLength, lengthField, 0, child};
+      bytes.insert(bytes.end(), key, key + keyLength);
+      item.payload = bytes.size();
+      if (isLeaf)
+         bytes.insert(bytes.end(), payload, payload + (lengthField & ~BTreeNode::blobFlag));
+      items.push_back(item);
+   }
+
+   void add(u8 *key, unsigned keyLength, u64 lengthField, u8 *payload, BTreeNode *child)
+   {
+      unsigned keyPrefix;
+      // the separator above the items is at most as long as the next key
+      if (items.size() >= minItems() &&
+          BTreeNode::bulkNodeSpace(isLeaf, items.size() + 1, lower.size(), keyLength) + grow(key, keyLength, lengthField, keyPrefix) > budget)
+         cut(items.size(), key, keyLength);
+      push(key, keyLength, lengthField, payload, child);
+   }
+
+   // the upper fence of a node that ends before item n
+   std::vector<u8> separator(unsigned n, const u8 *nextKey, unsigned nextLength)
+   {
+      u8 *last = keyOf(n - 1);
+      unsigned lastLength = items[n - 1].keyLength;
+      unsigned cut = commonPrefix(last, lastLength, nextKey, nextLength) + 1;
+      if (isLeaf && BTreeNode::truncatedSeparators && cut < lastLength && cut < nextLength)
+         return std::vector<u8>(nextKey, nextKey + cut);
+      return std::vector<u8>(last, last + lastLength);
+   }
+
+   bool fits(unsigned records, std::vector<u8> &upper)
+   {
+      unsigned nodePrefix = (lower.empty() || upper.empty()) ? 0 : commonPrefix(lower.data(), lower.size(), upper.data(), upper.size());
+      unsigned space = BTreeNode::bulkNodeSpace(isLeaf, records, lower.size(), upper.size());
+      for (unsigned i = 0; i < records; i++)
+         space += BTreeNode::bulkRecordSpace(isLeaf, items[i].keyLength, items[i].lengthField, nodePrefix);
+      return space <= pageSize;
+   }
+
+   void write(unsigned records, std::vector<u8> &upper, BTreeNode *upperChild)
+   {
+      BTreeNode *node = BTreeNode::allocateFresh(pages, isLeaf);
+      node->setFences(lower.empty() ? nullptr : lower.data(), lower.size(), upper.empty() ? nullptr : upper.data(), upper.size());
+      for (unsigned i = 0; i < records; i++)
+         node->append(keyOf(i), items[i].keyLength, isLeaf ? SwipType(items[i].lengthField) : items[i].child, bytes.data() + items[i].payload);
+      if (!isLeaf)
+         node->upper = upperChild;
+      node->finishBulk();
+      nodes.push_back(node);
+   }
+
+   // writes a node with at most the first n items, the items after it start the next node
+   void cut(unsigned n, const u8 *nextKey, unsigned nextLength)
+   {
+      std::vector<u8> sep = separator(n, nextKey, nextLength);
+      while (!fits(records(n), sep))
       {
-         return node->getPayloadLength(pos); 
+         n--;
+         assert(n >= minItems());
+         sep = separator(n, keyOf(n), items[n].keyLength);
       }
-      else
+      write(records(n), sep, isLeaf ? nullptr : items[n - 1].child);
+      seps.push_back(sep);
+      lower.swap(sep);
+
+      std::vector<Item> rest(items.begin() + n, items.end());
+      size_t base = rest.empty() ? 0 : rest.front().key;
+      std::vector<u8> restBytes(bytes.begin() + base, rest.empty() ? bytes.begin() : bytes.end());
+      items.clear();
+      bytes.clear();
+      prefix = lower.size();
+      used = 0;
+      for (Item &item : rest)
+         push(restBytes.data() + item.key - base, item.keyLength, item.lengthField, restBytes.data() + item.payload - base, item.child);
+   }
+
+   // writes the rest of the level, the last node has no upper fence and so no prefix
+   void finish(BTreeNode *lastChild)
+   {
+      std::vector<u8> none;
+      while (!fits(items.size(), none))
+         cut(items.size() - 1, keyOf(items.size() - 1), items.back().keyLength);
+      if (!items.empty() || lastChild)
+         write(items.size(), none, lastChild);
+   }
+};
+
+// packs the leaves from the sorted source, then builds each inner level from the nodes and separators below
+template <class Config>
+void BTreeT<Config>::bulkLoad(const std::function<bool(BulkRecord &)> &source, double fillFactor)
+{
+   if (root->isInner() || root->count)
+      throw std::invalid_argument("bulk load needs an empty tree");
+   std::vector<BTreeNode *> nodes;
+   std::vector<std::vector<u8>> seps;
+   {
+      BulkLevel<Config> leaves(pages, true, fillFactor);
+      std::vector<u8> previous;
+      BulkRecord record;
+      for (bool first = true; source(record); first = false)
       {
-         return node->getPayloadLength(pos);
+         if (!first && BTreeNode::cmpKeys(record.key, previous.data(), record.keyLength, previous.size()) <= 0)
+            throw std::invalid_argument("bulk load keys are not in ascending order");
+         if (!BTreeNode::acceptsPayload(record.valueLength))
+            throw std::invalid_argument("payload length does not fit the leaf record format");
+         previous.assign(record.key, record.key + record.keyLength);
+         if (record.valueLength <= BTreeNode::blobThreshold)
+         {
+            leaves.add(record.key, record.keyLength, record.valueLength, record.value, nullptr);
+            continue;
+         }
+         BlobRef ref{BlobPage::write(pages, record.value, record.valueLength), record.valueLength};
+         leaves.add(record.key, record.keyLength, sizeof(BlobRef) | BTreeNode::blobFlag, reinterpret_cast<u8 *>(&ref), nullptr);
       }
+      leaves.finish(nullptr);
+      nodes.swap(leaves.nodes);
+      seps.swap(leaves.seps);
+   }
+   if (nodes.empty())
+      return;
+   while (nodes.size() > 1)
+   {
+      BulkLevel<Config> inner(pages, false, fillFactor);
+      for (unsigned j = 0; j + 1 < nodes.size(); j++)
+         inner.add(seps[j].data(), seps[j].size(), 0, nullptr, nodes[j]);
+      inner.finish(nodes.back());
+      nodes.swap(inner.nodes);
+      seps.swap(inner.seps);
    }
-   return 0;
+   BTreeNode::release(root);
+   root = nodes[0];
+   // the inner records are appended without counts, they are summed up once for the whole tree
+   if constexpr (BTreeNode::countRecords)
+      root->recount();
 }
-void BTree::insert(u8 *key, unsigned keyLength, u64 payloadLength, u8 *payload)
+
+template <class Config>
+bool BTreeT<Config>::upsert(u8 *key, unsigned keyLength, u64 payloadLength, u8 *payload, bool insertMissing)
 {
-   BTreeNode *node = root;
-   BTreeNode *parent = nullptr;
-   while (node->isInner())
+   if (!BTreeNode::acceptsPayload(payloadLength))
+      throw std::invalid_argument("payload length does not fit the leaf record format");
+   if (payloadLength <= BTreeNode::blobThreshold)
+      return upsertRecord(key, keyLength, payloadLength, payload, insertMissing);
+   BlobRef ref{BlobPage::write(pages, payload, payloadLength), payloadLength};
+   if (upsertRecord(key, keyLength, sizeof(BlobRef) | BTreeNode::blobFlag, reinterpret_cast<u8 *>(&ref), insertMissing))
+      return true;
+   BlobPage::release(pages, ref.first);
+   return false;
+}
+// one descent: the payload of an existing record is replaced in its leaf, only a record that
+// does not fit its page anymore is removed and inserted again
+template <class Config>
+bool BTreeT<Config>::upsertRecord(u8 *key, unsigned keyLength, u64 lengthField, u8 *payload, bool insertMissing)
+{
+   BTreeNode *path[maxHeight];
+   unsigned positions[maxHeight];
+   unsigned depth = 0;
+   BTreeNode *node = findLeaf(key, keyLength, path, positions, depth);
+   int pos = node->template search<true>(key, keyLength);
+   if (pos != -1)
+   {
+      if (node->updatePayload(pos, SwipType(lengthField), payload))
+         return true;
+      node->remove(key, keyLength);
+      addRecords(path, positions, depth, -1);
+   }
+   else if (!insertMissing)
+      return false;
+   if (node->insert(key, keyLength, SwipType(lengthField), payload))
+   {
+      addRecords(path, positions, depth, 1);
+      return true;
+   }
+   splitNode(node, depth ? path[depth - 1] : nullptr, key, keyLength);
+   insertRecord(key, keyLength, lengthField, payload);
+   return true;
+}
+// nodes[0..depth] is the path from the root to the leaf of the last key. bounds[l] is the deepest
+// level above l that did not take its upper child, the separator there is the highest key below
+// nodes[l], -1 if nodes[l] is at the right edge of the tree. the path stays valid until a split
+template <class Config>
+void BTreeT<Config>::insertSortedBatch(u8 *const *keys, const u16 *keyLengths, u8 *const *values, const u64 *valueLengths, unsigned n)
+{
+   BTreeNode *nodes[maxHeight + 1];
+   unsigned positions[maxHeight];
+   int bounds[maxHeight + 1];
+   unsigned depth = 0;
+   u8 *key = nullptr;
+   unsigned keyLength = 0;
+   u8 *previous = nullptr;
+   unsigned previousLength = 0;
+   // the separator bounding the leaf is copied once per leaf, those above only when the leaf is left
+   std::vector<u8> leafBound;
+   std::vector<u8> separator;
+   auto copySeparator = [&](int level, std::vector<u8> &out)
+   {
+      out.resize(nodes[level]->getFullKeyLength(positions[level]));
+      nodes[level]->copyKeyOut(positions[level], out.data(), out.size());
+   };
+   auto descend = [&](unsigned level)
+   {
+      if (level == 0)
+      {
+         nodes[0] = root;
+         bounds[0] = -1;
+      }
+      while (nodes[level]->isInner())
+      {
+         assert(level < maxHeight);
+         BTreeNode *node = nodes[level];
+         unsigned pos = node->lookupInnerPos(key, keyLength);
+         positions[level] = pos;
+         bounds[level + 1] = pos < node->count ? int(level) : bounds[level];
+         nodes[level + 1] = pos < node->count ? node->getChild(pos) : node->upper;
+         level++;
+      }
+      depth = level;
+      if (bounds[depth] != -1)
+         copySeparator(bounds[depth], leafBound);
+   };
+
+   for (unsigned i = 0; i < n; i++)
    {
+      key = keys[i];
+      keyLength = keyLengths[i];
+      if (!key || !values[i])
+         continue;
+      if (previous && BTreeNode::cmpKeys(key, previous, keyLength, previousLength) < 0)
+         throw std::invalid_argument("sorted batch keys are not in ascending order");
+      if (!BTreeNode::acceptsPayload(valueLengths[i]))
+         throw std::invalid_argument("payload length does not fit the leaf record format");
+      u64 lengthField = valueLengths[i];
+      u8 *payload = values[i];
+      BlobRef ref;
+      if (valueLengths[i] > BTreeNode::blobThreshold)
+      {
+         ref = BlobRef{BlobPage::write(pages, values[i], valueLengths[i]), valueLengths[i]};
+         lengthField = sizeof(BlobRef) | BTreeNode::blobFlag;
+         payload = reinterpret_cast<u8 *>(&ref);
+      }
 
-      parent = node;
-      node = node->lookupInner(key, keyLength);
+      if (!previous)
+         descend(0);
+      else if (bounds[depth] != -1 && BTreeNode::cmpKeys(key, leafBound.data(), keyLength, leafBound.size()) > 0)
+      {
+         // the key is past the leaf, climb to the deepest node on the path that still covers it
+         unsigned level = bounds[depth];
+         while (bounds[level] != -1)
+         {
+            copySeparator(bounds[level], separator);
+            if (BTreeNode::cmpKeys(key, separator.data(), keyLength, separator.size()) <= 0)
+               break;
+            level = bounds[level];
+         }
+         descend(level);
+      }
+      previous = key;
+      previousLength = keyLength;
+
+      while (true)
+      {
+         BTreeNode *leaf = nodes[depth];
+         int pos = leaf->template lowerBound<true>(key, keyLength);
+         if (pos != -1)
+         {
+            if (leaf->updatePayload(pos, SwipType(lengthField), payload))
+               break;
+            leaf->remove(key, keyLength);
+            addRecords(nodes, positions, depth, -1);
+         }
+         if (leaf->insert(key, keyLength, SwipType(lengthField), payload))
+         {
+            addRecords(nodes, positions, depth, 1);
+            break;
+         }
+         descend(splitPath(nodes, depth));
+      }
    }
-   assert(node->isSorted(node->slot, node->count));
-   if (node->insert(key, keyLength, SwipType(payloadLength), payload))
-      return;
-   splitNode(node, parent, key, keyLength);
-   insert(key, keyLength, payloadLength, payload);
 }
-void BTree::lookupInner(u8 *key, unsigned keyLength)
+template <class Config>
+void BTreeT<Config>::lookupInner(u8 *key, unsigned keyLength)
 {
    BTreeNode *node = root;
    while (node->isInner())
       node = node->lookupInner(key, keyLength);
    assert(node);
 }
-void BTree::splitNode(BTreeNode *node, BTreeNode *parent, u8 *key, unsigned keyLength)
+template <class Config>
+void BTreeT<Config>::splitNode(BTreeNode *node, BTreeNode *parent, u8 *key, unsigned keyLength)
 {
    if (!parent)
    {
-      parent = BTreeNode::makeInner();
+      parent = BTreeNode::makeInner(pages);
       parent->upper = node;
       root = parent;
    }
-   if (node->is_eyt)
-   {
-      node->convertFromEytzinger(node->slot, node->count, node->slot[node->count]);
-   }
-
-   BTreeNode::SeparatorInfo sepInfo = node->findSep();
+   typename BTreeNode::SeparatorInfo sepInfo = node->findSep();
    unsigned spaceNeededParent = BTreeNode::spaceNeeded(sepInfo.length, parent->prefix_len);
    if (parent->allocateSpace(spaceNeededParent))
    {
@@ -103,7 +472,8 @@ void BTree::splitNode(BTreeNode *node, BTreeNode *parent, u8 *key, unsigned keyL
       splitInner(parent, key, keyLength);
    }
 }
-void BTree::splitInner(BTreeNode *splitingNode, u8 *key, unsigned keyLength)
+template <class Config>
+void BTreeT<Config>::splitInner(BTreeNode *splitingNode, u8 *key, unsigned keyLength)
 {
    BTreeNode *node = root;
    BTreeNode *parent = nullptr;
@@ -115,169 +485,725 @@ void BTree::splitInner(BTreeNode *splitingNode, u8 *key, unsigned keyLength)
    splitNode(splitingNode, parent, key, keyLength);
 }
 
-bool BTree::merge_help(u8 *key, unsigned keyLength, BTreeNode *node)
+// like splitNode with the parents taken from the path instead of a new descent. a full parent is
+// split first and the node is left for the retry of the insert
+template <class Config>
+unsigned BTreeT<Config>::splitPath(BTreeNode **nodes, unsigned level)
 {
-   BTreeNode *parent = nullptr;
-   int pos = 0;
-   while (node->isInner())
+   for (;; level--)
    {
-      parent = node;
-      node->convertFromEytzinger(node->slot, node->count, node->slot[node->count]);
-      pos = node->lowerBound<false>(key, keyLength);
-      node = (pos == node->count) ? node->upper : node->getChild(pos);
+      BTreeNode *node = nodes[level];
+      BTreeNode *parent = level ? nodes[level - 1] : nullptr;
+      if (!parent)
+      {
+         parent = BTreeNode::makeInner(pages);
+         parent->upper = node;
+         root = parent;
+      }
+      typename BTreeNode::SeparatorInfo sepInfo = node->findSep();
+      if (parent->allocateSpace(BTreeNode::spaceNeeded(sepInfo.length, parent->prefix_len)))
+      {
+         u8 sepKey[sepInfo.length];
+         node->getSep(sepKey, sepInfo);
+         node->split(parent, sepInfo.slot, sepKey, sepInfo.length);
+         // the nodes above the parent are unchanged, a new root is reached from the top again
+         return level ? level - 1 : 0;
+      }
    }
-   if (node->spacePostCompact() >= BTreeNodeHeader::under_full)
+}
+
+// merges an underfull node into its right sibling if the records fit, the merged away node is freed
+template <class Config>
+bool BTreeT<Config>::mergeRight(BTreeNode *node, BTreeNode *parent, unsigned pos)
+{
+   // the upper child has no right sibling
+   if (pos >= parent->count || node->spacePostCompact() < node->underFull())
+      return false;
+   BTreeNode *right = (pos + 1 < parent->count) ? parent->getChild(pos + 1) : parent->upper;
+   // cheap bound before merge computes the exact space
+   if (node->pageSize() - node->spacePostCompact() > right->spacePostCompact() || !node->merge(pos, parent, right))
+      return false;
+   BTreeNode::release(node);
+   return true;
+}
+
+// an inner root without separators only forwards to its upper child
+template <class Config>
+void BTreeT<Config>::collapseRoot()
+{
+   while (root->isInner() && root->count == 0)
+   {
+      BTreeNode *old = root;
+      root = root->upper;
+      BTreeNode::release(old);
+   }
+}
+
+template <class Config>
+u64 BTreeT<Config>::removeRange(u8 *lo, unsigned loLength, u8 *hi, unsigned hiLength)
+{
+   if (BTreeNode::cmpKeys(lo, hi, loLength, hiLength) >= 0)
+      return 0;
+   u64 removed = removeRange(root, lo, loLength, hi, hiLength, false, false);
+   // a merge of two nodes makes their children at the seam neighbours after those were merged,
+   // the seam is merged once more from the leaf of lo up
+   BTreeNode *path[maxHeight];
+   unsigned positions[maxHeight];
+   unsigned depth = 0;
+   BTreeNode *node = findLeaf(lo, loLength, path, positions, depth);
+   mergeUp(node, path, positions, depth);
+   return removed;
+}
+
+// only the children of lo and hi can be partly in the range, they are trimmed first. the children
+// between them are freed and one empty chain takes their place, the positions of lo and hi in node
+// stay valid until then. last the children around the range are merged like after a remove
+template <class Config>
+u64 BTreeT<Config>::removeRange(BTreeNode *node, u8 *lo, unsigned loLength, u8 *hi, unsigned hiLength, bool leftCovered, bool rightCovered)
+{
+   if (!node->isInner())
+   {
+      unsigned from = leftCovered ? 0 : node->template lowerBound<false>(lo, loLength);
+      unsigned to = rightCovered ? node->count : node->template lowerBound<false>(hi, hiLength);
+      if (from >= to)
+         return 0;
+      node->removeSlots(from, to);
+      return to - from;
+   }
+   auto child = [&](unsigned pos) -> BTreeNode *
+   { return pos < node->count ? node->getChild(pos) : node->upper; };
+   unsigned first = leftCovered ? 0 : node->lookupInnerPos(lo, loLength);
+   unsigned last = rightCovered ? node->count : node->lookupInnerPos(hi, hiLength);
+   // trims child pos and takes what it lost off the count of its record
+   auto trim = [&](unsigned pos, bool left, bool right)
+   {
+      u64 records = removeRange(child(pos), lo, loLength, hi, hiLength, left, right);
+      if constexpr (BTreeNode::countRecords)
+         node->childRecords(pos) -= records;
+      return records;
+   };
+   u64 removed = 0;
+   if (first == last)
+      removed += trim(first, leftCovered, rightCovered);
+   else
    {
-      if (node != root && (parent->count >= 2) && (pos + 1) < parent->count)
+      if (!rightCovered)
+         removed += trim(last, true, false);
+      if (!leftCovered)
+         removed += trim(first, false, true);
+   }
+
+   // children begin to end are wholly inside the range
+   int begin = leftCovered ? first : first + 1;
+   int end = rightCovered ? last : int(last) - 1;
+   if (begin <= end)
+   {
+      BTreeNode *chain = emptyChain(child(begin), child(end));
+      for (int pos = begin; pos <= end; pos++)
+         removed += freeSubtree(child(pos));
+      if (unsigned(end) < node->count)
       {
-         BTreeNode *right = parent->getChild(pos + 1);
-         if (right->spacePostCompact() >= BTreeNodeHeader::under_full)
-         {
-            return node->merge(pos, parent, right);
-         }
+         node->getChild(end) = chain;
+         node->removeSlots(begin, end);
       }
+      else
+      {
+         node->upper = chain;
+         node->removeSlots(begin, node->count);
+      }
+      if constexpr (BTreeNode::countRecords)
+         node->childRecords(begin) = 0;
+      dropChain(node, begin);
    }
-   return true;
+   // the trimmed children and what is left of the chain, from the right so the positions stay
+   for (unsigned pos = min(first + 3, unsigned(node->count)); pos-- > first;)
+      mergeRight(node->getChild(pos), node, pos);
+   return removed;
 }
 
-bool BTree::remove(u8 *key, unsigned keyLength)
+// frees the pages and blobs of a subtree, returns its record count
+template <class Config>
+u64 BTreeT<Config>::freeSubtree(BTreeNode *node)
 {
-   BTreeNode *node = root;
-   BTreeNode *parent = nullptr;
-   int pos = 0;
-   while (node->isInner())
+   u64 records = 0;
+   if (node->isInner())
    {
-      parent = node;
-      pos = node->lookupInnerPos(key, keyLength);
-      node = node->lookupInner(key, keyLength);   
+      for (unsigned i = 0; i < node->count; i++)
+         records += freeSubtree(node->getChild(i));
+      records += freeSubtree(node->upper);
    }
-   static_cast<void>(parent);
-   if (!node->remove(key, keyLength))
-      return false;
+   else
+   {
+      node->releaseBlobs();
+      records = node->count;
+   }
+   BTreeNode::release(node);
+   return records;
+}
 
-   if (parent && node->spacePostCompact() >= BTreeNodeHeader::under_full)
+// empty nodes from the level of first down to the leaves, each one only has its upper below. the
+// fences span from the lower fence of first to the upper fence of last
+template <class Config>
+typename BTreeT<Config>::BTreeNode *BTreeT<Config>::emptyChain(BTreeNode *first, BTreeNode *last)
+{
+   BTreeNode *node = first->isInner() ? BTreeNode::makeInner(pages) : BTreeNode::makeLeaf(pages);
+   node->setFencesOf(first, last);
+   if (node->isInner())
+      node->upper = emptyChain(first->count ? first->getChild(0) : first->upper, last->upper);
+   return node;
+}
+
+// merges the empty chain at pos into its right sibling, the rest of the chain becomes the first
+// child of the sibling and is merged one level down. a chain in the upper position takes the
+// records of its left sibling instead and stays upper. stops at the first level without room
+template <class Config>
+void BTreeT<Config>::dropChain(BTreeNode *parent, unsigned pos)
+{
+   while (true)
    {
-      if (node != root && (parent->count >= 2) && (2 * pos + 2) < parent->count)
+      BTreeNode *chain = pos < parent->count ? parent->getChild(pos) : parent->upper;
+      bool inner = chain->isInner();
+      if (pos < parent->count)
+      {
+         BTreeNode *right = (pos + 1 < parent->count) ? parent->getChild(pos + 1) : parent->upper;
+         if (!mergeRight(chain, parent, pos))
+            return;
+         parent = right;
+         pos = 0;
+      }
+      else
       {
-         BTreeNode *right = parent->getChild(2 * pos + 2);
-         if (right->spacePostCompact() >= BTreeNodeHeader::under_full)
-            return merge_help(key, keyLength, parent);
+         if (pos == 0)
+            return;
+         BTreeNode *left = parent->getChild(pos - 1);
+         if (!left->merge(pos - 1, parent, chain))
+            return;
+         BTreeNode::release(left);
+         parent = chain;
+         pos = chain->count;
       }
+      if (!inner)
+         return;
    }
+}
+
+// descends to the leaf of key, path gets the inner nodes on the way and positions the child taken in each
+template <class Config>
+typename BTreeT<Config>::BTreeNode *BTreeT<Config>::findLeaf(u8 *key, unsigned keyLength, BTreeNode **path, unsigned *positions, unsigned &depth)
+{
+   BTreeNode *node = root;
+   while (node->isInner())
+   {
+      assert(depth < maxHeight);
+      unsigned pos = node->lookupInnerPos(key, keyLength);
+      path[depth] = node;
+      positions[depth++] = pos;
+      node = (pos == node->count) ? node->upper : node->getChild(pos);
+   }
+   return node;
+}
+
+// a merge removes a record from the parent, which may then merge with its own sibling
+template <class Config>
+void BTreeT<Config>::mergeUp(BTreeNode *node, BTreeNode **path, unsigned *positions, unsigned depth)
+{
+   while (depth > 0 && mergeRight(node, path[depth - 1], positions[depth - 1]))
+      node = path[--depth];
+   collapseRoot();
+}
+
+template <class Config>
+void BTreeT<Config>::addRecords(BTreeNode **path, unsigned *positions, unsigned depth, int delta)
+{
+   if constexpr (BTreeNode::countRecords)
+      for (unsigned level = 0; level < depth; level++)
+         path[level]->childRecords(positions[level]) += delta;
+}
 
+template <class Config>
+bool BTreeT<Config>::remove(u8 *key, unsigned keyLength)
+{
+   BTreeNode *path[maxHeight];
+   unsigned positions[maxHeight];
+   unsigned depth = 0;
+   BTreeNode *node = findLeaf(key, keyLength, path, positions, depth);
+   if (!node->remove(key, keyLength))
+      return false;
+   addRecords(path, positions, depth, -1);
+   mergeUp(node, path, positions, depth);
    return true;
 }
-BTree::~BTree()
+template <class Config>
+BTreeT<Config>::~BTreeT()
 {
-   makeAllEyt(root);
-   root->destroy();
-   // delete this; <-- segfault
-   }
-BTree *btree_create()
+   // nodes, search indexes and blobs all live in the chunks of the tree
+   pages.releaseAll();
+}
+template <class Config>
+BTreeT<Config> *btree_create()
 {
-   return new BTree();
+   return new BTreeT<Config>();
 }
 
-void btree_destroy(BTree *btree)
+template <class Config>
+void btree_destroy(BTreeT<Config> *btree)
 {
-   btree->~BTree();
+   btree->~BTreeT();
 }
 // replaces exising record if any
-void btree_insert(BTree *btree, u8 *key, u16 keyLength, u8 *payload, u16 payloadLength)
+template <class Config>
+void btree_insert(BTreeT<Config> *btree, u8 *key, u16 keyLength, u8 *payload, u64 payloadLength)
 
 {
    if (!key || !payload)
       return;
-   u64 payloadLength16;
-   bool result = btree->lookup(key, keyLength, payloadLength16, payload);
-   if (result)
+   btree->upsert(key, keyLength, payloadLength, payload);
+}
+
+template <class Config>
+void btree_insert_sorted_batch(BTreeT<Config> *btree, u8 *const *keys, const u16 *keyLengths, u8 *const *values, const u64 *valueLengths, unsigned n)
+{
+   btree->insertSortedBatch(keys, keyLengths, values, valueLengths, n);
+}
+
+template <class Config>
+unsigned btree_lookup_batch(BTreeT<Config> *btree, u8 *const *keys, const u16 *keyLengths, unsigned n, ValueView *values)
+{
+   return btree->lookupBatch(keys, keyLengths, n, values);
+}
+
+template <class Config>
+void btree_bulk_load(BTreeT<Config> *btree, const std::function<bool(BulkRecord &)> &source, double fillFactor)
+{
+   btree->bulkLoad(source, fillFactor);
+}
+
+template <class Config>
+bool btree_update(BTreeT<Config> *btree, u8 *key, u16 keyLength, u8 *payload, u64 payloadLength)
+{
+   if (!key || !payload)
+      return false;
+   return btree->upsert(key, keyLength, payloadLength, payload, false);
+}
+
+template <class Config>
+u8 *btree_lookup(BTreeT<Config> *btree, u8 *key, u16 keyLength, u64 &payloadLength)
+{
+   ValueView value;
+   if (keyLength == 0 || !key || !btree->lookup(key, keyLength, value))
    {
-      btree->remove(key, keyLength);
+      payloadLength = 0;
+      return nullptr;
    }
-   btree->insert(key, keyLength, payloadLength, payload);
+   u8 *result = new u8[value.length];
+   value.copyTo(result);
+   payloadLength = value.length;
+   return result;
 }
 
-u8 *btree_lookup(BTree *btree, u8 *key, u16 keyLength, u16 &payloadLength)
+template <class Config>
+bool btree_lookup_view(BTreeT<Config> *btree, u8 *key, u16 keyLength, ValueView &value)
 {
    if (keyLength == 0 || !key)
-      return nullptr;
-   u8 *result = new u8[btree->getPayloadLenLookup(key,keyLength)]; 
-   u64 payloadLength64;
-   if (btree->lookup(key, keyLength, payloadLength64, result))
+      return false;
+   return btree->lookup(key, keyLength, value);
+}
+
+template <class Config>
+bool btree_lookup_into(BTreeT<Config> *btree, u8 *key, u16 keyLength, u8 *buffer, u64 bufferLength, u64 &valueLength)
+{
+   ValueView value;
+   valueLength = 0;
+   if (keyLength == 0 || !key || !btree->lookup(key, keyLength, value))
+      return false;
+   valueLength = value.length;
+   if (value.length <= bufferLength)
+      value.copyTo(buffer);
+   return true;
+}
+
+template <class Config>
+bool btree_remove(BTreeT<Config> *btree, u8 *key, u16 keyLength)
+{
+   return btree->remove(key, keyLength);
+}
+
+template <class Config>
+u64 btree_remove_range(BTreeT<Config> *btree, u8 *lo, u16 loLength, u8 *hi, u16 hiLength)
+{
+   return btree->removeRange(lo, loLength, hi, hiLength);
+}
+
+// repacks the leaves below the leaf parent of defragmentKey, returns true if it was the last one of the pass
+template <class Config>
+bool BTreeT<Config>::defragmentStep(double targetFill)
+{
+   if (!root->isInner())
    {
-      payloadLength = payloadLength64;
-      return result;
+      defragmentKey.clear();
+      return true;
    }
-   else
+   u8 empty = 0;
+   u8 *key = defragmentKey.empty() ? &empty : defragmentKey.data();
+   // the deepest separator above the leaf parent bounds the keys below it
+   std::vector<u8> next;
+   bool last = true;
+   BTreeNode *node = root;
+   for (;;)
    {
-      payloadLength = 0;
-      return nullptr;
+      unsigned pos = node->lookupInnerPos(key, defragmentKey.size());
+      BTreeNode *child = (pos == node->count) ? node->upper : node->getChild(pos);
+      if (child->is_leaf)
+         break;
+      if (pos < node->count)
+      {
+         next.resize(node->getFullKeyLength(pos));
+         node->copyKeyOut(pos, next.data(), next.size());
+         last = false;
+      }
+      node = child;
    }
+   node->repackLeaves(targetFill);
+   if (last)
+   {
+      defragmentKey.clear();
+      return true;
+   }
+   // the smallest key after the separator
+   next.push_back(0);
+   defragmentKey.swap(next);
+   return false;
 }
 
-bool btree_remove(BTree *btree, u8 *key, u16 keyLength)
+template <class Config>
+bool btree_defragment(BTreeT<Config> *tree, double targetFill, std::chrono::microseconds budget)
 {
-   return btree->remove(key, keyLength);
+   auto start = std::chrono::steady_clock::now();
+   while (!tree->defragmentStep(targetFill))
+      if (std::chrono::steady_clock::now() - start >= budget)
+         return false;
+   return true;
 }
 
-void inner_rec(BTreeNode *node, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
-               const std::function<bool(unsigned int, uint8_t *, unsigned int)>
-                   &found_callback)
+template <class BTreeNode>
+void memory_rec(BTreeNode *node, unsigned depth, std::vector<LevelMemory> &byDepth)
 {
-   if (node->is_leaf && cont)
+   if (byDepth.size() <= depth)
+      byDepth.resize(depth + 1);
+   node->accountMemory(byDepth[depth]);
+   if (node->is_leaf)
+      return;
+   for (unsigned i = 0; i < node->count; i++)
+      memory_rec<BTreeNode>(node->getChild(i), depth + 1, byDepth);
+   memory_rec<BTreeNode>(node->upper, depth + 1, byDepth);
+}
+
+template <class Config>
+MemoryUsage btree_memory_usage(BTreeT<Config> *tree)
+{
+   MemoryUsage usage;
+   memory_rec(tree->root, 0, usage.levels);
+   // the walk counts from the root, the levels count from the leaves
+   std::reverse(usage.levels.begin(), usage.levels.end());
+   usage.chunkBytes = tree->pages.allocatedBytes();
+   usage.usedBytes = tree->pages.usedBytes();
+   return usage;
+}
+
+template <class Config>
+bool BTreeCursorT<Config>::seek(u8 *key, unsigned keyLength)
+{
+   depth = 0;
+   leaf = tree->findLeaf(key, keyLength, path, positions, depth);
+   prefetchSibling(true);
+   slot = leaf->template lowerBound<false>(key, keyLength);
+   return slot < leaf->count || nextLeaf();
+}
+
+// an exact match is the record itself, otherwise the one before the lower bound, which may be in
+// the previous leaf
+template <class Config>
+bool BTreeCursorT<Config>::seekReverse(u8 *key, unsigned keyLength)
+{
+   depth = 0;
+   leaf = tree->findLeaf(key, keyLength, path, positions, depth);
+   prefetchSibling(false);
+   int exact = leaf->template lowerBound<true>(key, keyLength);
+   if (exact != -1)
    {
-      bool shouldContinue = true;
-      for (int i = 0; i < node->count; i++)
+      slot = exact;
+      return true;
+   }
+   slot = leaf->template lowerBound<false>(key, keyLength);
+   return prev();
+}
+
+template <class Config>
+bool BTreeCursorT<Config>::next()
+{
+   if (!leaf)
+      return false;
+   return ++slot < leaf->count || nextLeaf();
+}
+
+template <class Config>
+bool BTreeCursorT<Config>::prev()
+{
+   if (!leaf)
+      return false;
+   if (slot > 0)
+   {
+      slot--;
+      return true;
+   }
+   return prevLeaf();
+}
+
+template <class Config>
+unsigned BTreeCursorT<Config>::key(u8 *out)
+{
+   unsigned length = leaf->getFullKeyLength(slot);
+   leaf->copyKeyOut(slot, out, length);
+   return length;
+}
+
+// up to the deepest inner node on the path with a child right of it, then down the leftmost
+// children of that child. empty leaves are passed over
+template <class Config>
+bool BTreeCursorT<Config>::nextLeaf()
+{
+   while (true)
+   {
+      unsigned level = depth;
+      while (level > 0 && positions[level - 1] == path[level - 1]->count)
+         level--;
+      if (level == 0)
       {
-         u8 key_inner[node->getFullKeyLength(i)]; 
-         node->copyKeyOut(i, key_inner, node->getFullKeyLength(i));
-         if (BTreeNode::cmpKeys(key, key_inner, keyLength, node->getFullKeyLength(i)) > 0)
-         {
-            continue;
-         }
-         auto fullKeyLength = node->getFullKeyLength(i);
-         node->copyKeyOut(i, keyOut, fullKeyLength);
-         auto payload = (node->isLarge(i)) ? node->getPayloadLarge(i) : node->getPayload(i);
-         auto payloadLength = node->getPayloadLength(i) ;
-         shouldContinue = found_callback(fullKeyLength, payload, payloadLength);
-         if (!shouldContinue)
-         {
-            cont = false;
-            return;
-         }
+         leaf = nullptr;
+         return false;
+      }
+      BTreeNode *parent = path[level - 1];
+      unsigned pos = ++positions[level - 1];
+      BTreeNode *node = pos < parent->count ? parent->getChild(pos) : parent->upper;
+      depth = level;
+      while (node->isInner())
+      {
+         path[depth] = node;
+         positions[depth++] = 0;
+         node = node->count ? node->getChild(0) : node->upper;
       }
+      leaf = node;
+      slot = 0;
+      prefetchSibling(true);
+      if (leaf->count)
+         return true;
    }
-   else if (cont)
+}
+
+template <class Config>
+bool BTreeCursorT<Config>::prevLeaf()
+{
+   while (true)
    {
-      unsigned pos = node->lowerBound<false>(key,keyLength);
-      for (int i = pos; i < node->count; i++)
+      unsigned level = depth;
+      while (level > 0 && positions[level - 1] == 0)
+         level--;
+      if (level == 0)
+      {
+         leaf = nullptr;
+         return false;
+      }
+      BTreeNode *node = path[level - 1]->getChild(--positions[level - 1]);
+      depth = level;
+      while (node->isInner())
+      {
+         path[depth] = node;
+         positions[depth++] = node->count;
+         node = node->upper;
+      }
+      leaf = node;
+      prefetchSibling(false);
+      if (leaf->count)
       {
-         inner_rec(node->getChild(i), key, keyLength, keyOut, found_callback);
+         slot = leaf->count - 1;
+         return true;
       }
-      inner_rec(node->upper, key, keyLength, keyOut, found_callback);
    }
 }
 
+// the header and first slots of the leaf next to the current one under the same parent
+template <class Config>
+void BTreeCursorT<Config>::prefetchSibling(bool right)
+{
+   if (depth == 0)
+      return;
+   BTreeNode *parent = path[depth - 1];
+   unsigned pos = positions[depth - 1];
+   if (right ? pos >= parent->count : pos == 0)
+      return;
+   pos = right ? pos + 1 : pos - 1;
+   BTreeNode *sibling = pos < parent->count ? parent->getChild(pos) : parent->upper;
+   __builtin_prefetch(sibling);
+   __builtin_prefetch(reinterpret_cast<u8 *>(sibling) + 64);
+}
+
 // invokes the callback for all records greater than or equal to key, in order.
 // the key should be copied to keyOut before the call.
 // the callback should be invoked with keyLength, value pointer, and value
 // length iteration stops if there are no more keys or the callback returns
 // false.
-void btree_scan(BTree *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+template <class Config>
+void btree_scan(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+                const std::function<bool(unsigned int, const ValueView &)> &found_callback)
+{
+   BTreeCursorT<Config> cursor(tree);
+   for (bool found = cursor.seek(key, keyLength); found; found = cursor.next())
+      if (!found_callback(cursor.key(keyOut), cursor.value()))
+         return;
+}
+
+// scan with contiguous values, blob values are assembled in a buffer reused across the records
+template <class Config>
+void btree_scan(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
                 const std::function<bool(unsigned int, uint8_t *, unsigned int)>
                     &found_callback)
 {
-   if (!tree || !tree->root)
+   std::vector<u8> blobBuffer;
+   btree_scan(tree, key, keyLength, keyOut, [&](unsigned int fullKeyLength, const ValueView &value)
+              {
+                 if (!value.isBlob())
+                    return found_callback(fullKeyLength, value.data, value.length);
+                 blobBuffer.resize(value.length);
+                 value.copyTo(blobBuffer.data());
+                 return found_callback(fullKeyLength, blobBuffer.data(), value.length); });
+}
+
+template <class Config>
+void btree_scan_reverse(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+                        const std::function<bool(unsigned int, const ValueView &)> &found_callback)
+{
+   BTreeCursorT<Config> cursor(tree);
+   for (bool found = cursor.seekReverse(key, keyLength); found; found = cursor.prev())
+      if (!found_callback(cursor.key(keyOut), cursor.value()))
+         return;
+}
+
+template <class Config>
+void btree_scan_reverse(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+                        const std::function<bool(unsigned int, uint8_t *, unsigned int)>
+                            &found_callback)
+{
+   std::vector<u8> blobBuffer;
+   btree_scan_reverse(tree, key, keyLength, keyOut, [&](unsigned int fullKeyLength, const ValueView &value)
+                      {
+                         if (!value.isBlob())
+                            return found_callback(fullKeyLength, value.data, value.length);
+                         blobBuffer.resize(value.length);
+                         value.copyTo(blobBuffer.data());
+                         return found_callback(fullKeyLength, blobBuffer.data(), value.length); });
+}
+
+template <class Config>
+uint64_t btree_rank(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength)
+{
+   static_assert(BTreeNodeT<Config>::countRecords, "btree_rank needs a config with countRecords");
+   u64 below = 0;
+   BTreeNodeT<Config> *node = tree->root;
+   while (node->isInner())
    {
-      std::cout << "tree or tree->root is null" << std::endl;
-      return;
+      unsigned pos = node->lookupInnerPos(key, keyLength);
+      for (unsigned i = 0; i < pos; i++)
+         below += node->entryRecords(i);
+      node = pos < node->count ? node->getChild(pos) : node->upper;
    }
-   cont = true;
-
-   tree->makeAllSorted(tree->root);
-   inner_rec(tree->root, key, keyLength, keyOut, found_callback);
+   return below + node->template lowerBound<false>(key, keyLength);
+}
 
-   //tree-root->scan(key, keyLength, keyOut, found_callback); 
+template <class Config>
+uint64_t btree_count_range(BTreeT<Config> *tree, uint8_t *lo, uint16_t loLength, uint8_t *hi, uint16_t hiLength)
+{
+   if (BTreeNodeT<Config>::cmpKeys(lo, hi, loLength, hiLength) >= 0)
+      return 0;
+   return btree_rank(tree, hi, hiLength) - btree_rank(tree, lo, loLength);
+}
 
+// the child is the first one whose records reach past rank, rank is left relative to it
+template <class Config>
+bool btree_select(BTreeT<Config> *tree, uint64_t rank, BTreeCursorT<Config> &cursor)
+{
+   static_assert(BTreeNodeT<Config>::countRecords, "btree_select needs a config with countRecords");
+   cursor.tree = tree;
+   cursor.depth = 0;
+   BTreeNodeT<Config> *node = tree->root;
+   while (node->isInner())
+   {
+      unsigned pos = 0;
+      while (pos < node->count && rank >= node->entryRecords(pos))
+         rank -= node->entryRecords(pos++);
+      cursor.path[cursor.depth] = node;
+      cursor.positions[cursor.depth++] = pos;
+      node = pos < node->count ? node->getChild(pos) : node->upper;
+   }
+   if (rank >= node->count)
+   {
+      cursor.leaf = nullptr;
+      return false;
+   }
+   cursor.leaf = node;
+   cursor.slot = rank;
+   cursor.prefetchSibling(true);
+   return true;
 }
 
+#define INSTANTIATE_BTREE(Config)                                                              \
+   template struct BTreeT<Config>;                                                             \
+   template struct BTreeCursorT<Config>;                                                       \
+   template BTreeT<Config> *btree_create<Config>();                                            \
+   template void btree_destroy<Config>(BTreeT<Config> *);                                      \
+   template void btree_insert<Config>(BTreeT<Config> *, u8 *, u16, u8 *, u64);                 \
+   template bool btree_update<Config>(BTreeT<Config> *, u8 *, u16, u8 *, u64);                 \
+   template void btree_bulk_load<Config>(BTreeT<Config> *, const std::function<bool(BulkRecord &)> &, \
+                                         double);                                              \
+   template void btree_insert_sorted_batch<Config>(BTreeT<Config> *, u8 *const *, const u16 *, \
+                                                   u8 *const *, const u64 *, unsigned);         \
+   template u8 *btree_lookup<Config>(BTreeT<Config> *, u8 *, u16, u64 &);                      \
+   template bool btree_lookup_view<Config>(BTreeT<Config> *, u8 *, u16, ValueView &);          \
+   template unsigned btree_lookup_batch<Config>(BTreeT<Config> *, u8 *const *, const u16 *,    \
+                                                unsigned, ValueView *);                        \
+   template bool btree_lookup_into<Config>(BTreeT<Config> *, u8 *, u16, u8 *, u64, u64 &);     \
+   template bool btree_remove<Config>(BTreeT<Config> *, u8 *, u16);                            \
+   template u64 btree_remove_range<Config>(BTreeT<Config> *, u8 *, u16, u8 *, u16);            \
+   template MemoryUsage btree_memory_usage<Config>(BTreeT<Config> *);                          \
+   template bool btree_defragment<Config>(BTreeT<Config> *, double, std::chrono::microseconds); \
+   template void btree_scan<Config>(BTreeT<Config> *, uint8_t *, unsigned, uint8_t *,         \
+                                    const std::function<bool(unsigned int, uint8_t *, unsigned int)> &); \
+   template void btree_scan<Config>(BTreeT<Config> *, uint8_t *, unsigned, uint8_t *,         \
+                                    const std::function<bool(unsigned int, const ValueView &)> &); \
+   template void btree_scan_reverse<Config>(BTreeT<Config> *, uint8_t *, unsigned, uint8_t *, \
+                                            const std::function<bool(unsigned int, uint8_t *, unsigned int)> &); \
+   template void btree_scan_reverse<Config>(BTreeT<Config> *, uint8_t *, unsigned, uint8_t *, \
+                                            const std::function<bool(unsigned int, const ValueView &)> &);
+
+// the order statistics only exist for configs with countRecords
+#define INSTANTIATE_COUNTS(Config)                                                             \
+   template uint64_t btree_rank<Config>(BTreeT<Config> *, uint8_t *, uint16_t);               \
+   template uint64_t btree_count_range<Config>(BTreeT<Config> *, uint8_t *, uint16_t, uint8_t *, uint16_t); \
+   template bool btree_select<Config>(BTreeT<Config> *, uint64_t, BTreeCursorT<Config> &);
+
+INSTANTIATE_BTREE(DefaultConfig)
+INSTANTIATE_BTREE(CountedConfig)
+INSTANTIATE_COUNTS(CountedConfig)
+INSTANTIATE_BTREE(SimdConfig)
+INSTANTIATE_BTREE(WideHeadConfig)
+INSTANTIATE_BTREE(NodeIdConfig)
+INSTANTIATE_BTREE(LengthConfig<WideLengths>)
+INSTANTIATE_BTREE(LengthConfig<VarintLengths>)
+INSTANTIATE_BTREE(LengthConfig<FixedLengths<4>>)
+INSTANTIATE_BTREE(Pages8K)
+INSTANTIATE_BTREE(Pages16K)
+INSTANTIATE_BTREE(Pages32K)
+INSTANTIATE_BTREE(Pages64K)
+INSTANTIATE_BTREE(Inner4KLeaf16K)
+INSTANTIATE_BTREE(Inner4KLeaf64K)
+INSTANTIATE_BTREE(FixedKey<u32>)
+INSTANTIATE_BTREE(FixedKey<u64>)
@@ -17,33 +17,644 @@
 #include <string>
 #include <x86intrin.h>
 #include <functional>
+#include <new>
+#include <vector>
 
 #include <chrono>
 #include <stack>
 #include <thread>
 
-#include "../common.h"
+#include "eytzinger.hpp"
+#include "blob.hpp"
+#include "node_arena.hpp"
 using u8 = uint8_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
 using u64 = uint64_t;
 
 using namespace std;
-struct BTreeNode;
-using SwipType = BTreeNode *;
 static inline u64 swap(u64 x) { return __builtin_bswap64(x); }
 static inline u32 swap(u32 x) { return __builtin_bswap32(x); }
 static inline u16 swap(u16 x) { return __builtin_bswap16(x); }
+template <class Head>
+static inline u8 headByte(Head head, unsigned i) { return static_cast<u8>(head >> (8 * i)); }
 static int counter = 0;
 static int times = 0;
-struct BTreeNodeHeader
+
+/**
+ * @brief comparisons of the node searches, only counted in builds with -DBTREE_HEAD_STATS.
+ * compares counts the head comparisons of the search key (one per simd block
+ * compare), ties the ones that were equal and needed the rest of the key
+ */
+struct HeadStats
 {
-    static const unsigned PAGE_SIZE = 1024 *4;
-    static const unsigned under_full = PAGE_SIZE * 0.6;
-    static constexpr u8 limit = 254;
-    static constexpr u8 marker = 255;
+    u64 compares = 0;
+    u64 ties = 0;
+};
+extern HeadStats headStats;
+#ifdef BTREE_HEAD_STATS
+#define COUNT_HEAD_STAT(field) (headStats.field++)
+#else
+#define COUNT_HEAD_STAT(field)
+#endif
+
+/**
+ * @brief bitmask of the 16 heads starting at the 64 byte aligned pointer head that are smaller
+ * (orEqual: smaller or equal) than keyHead. used by the blocked slot format and the s-tree index
+ */
+template <bool orEqual>
+static inline u32 maskBelow(const u32 *head, u32 keyHead)
+{
+#if defined(__AVX512F__)
+    __m512i heads = _mm512_load_si512(head);
+    __m512i key = _mm512_set1_epi32(keyHead);
+    return orEqual ? _mm512_cmple_epu32_mask(heads, key) : _mm512_cmplt_epu32_mask(heads, key);
+#elif defined(__AVX2__)
+    // there is no unsigned compare in avx2, flipping the sign bit maps it to the signed one
+    const __m256i bias = _mm256_set1_epi32(0x80000000);
+    __m256i key = _mm256_xor_si256(_mm256_set1_epi32(keyHead), bias);
+    __m256i lo = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(head)), bias);
+    __m256i hi = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(head + 8)), bias);
+    u32 gtLo, gtHi;
+    if (orEqual)
+    {
+        gtLo = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(lo, key))) & 0xff;
+        gtHi = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(hi, key))) & 0xff;
+    }
+    else
+    {
+        gtLo = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, lo)));
+        gtHi = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, hi)));
+    }
+    return gtLo | (gtHi << 8);
+#else
+    u32 mask = 0;
+    for (unsigned i = 0; i < 16; i++)
+        mask |= u32(orEqual ? (head[i] <= keyHead) : (head[i] < keyHead)) << i;
+    return mask;
+#endif
+}
+
+// maskBelow for 8 byte heads, the 16 heads span two cache lines
+template <bool orEqual>
+static inline u32 maskBelow(const u64 *head, u64 keyHead)
+{
+#if defined(__AVX512F__)
+    __m512i key = _mm512_set1_epi64(keyHead);
+    __m512i lo = _mm512_load_si512(head);
+    __m512i hi = _mm512_load_si512(head + 8);
+    u32 maskLo = orEqual ? _mm512_cmple_epu64_mask(lo, key) : _mm512_cmplt_epu64_mask(lo, key);
+    u32 maskHi = orEqual ? _mm512_cmple_epu64_mask(hi, key) : _mm512_cmplt_epu64_mask(hi, key);
+    return maskLo | (maskHi << 8);
+#elif defined(__AVX2__)
+    const __m256i bias = _mm256_set1_epi64x(0x8000000000000000ull);
+    __m256i key = _mm256_xor_si256(_mm256_set1_epi64x(keyHead), bias);
+    u32 mask = 0;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        __m256i heads = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(head + 4 * i)), bias);
+        u32 m;
+        if (orEqual)
+            m = ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(heads, key))) & 0xf;
+        else
+            m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key, heads)));
+        mask |= m << (4 * i);
+    }
+    return mask;
+#else
+    u32 mask = 0;
+    for (unsigned i = 0; i < 16; i++)
+        mask |= u32(orEqual ? (head[i] <= keyHead) : (head[i] < keyHead)) << i;
+    return mask;
+#endif
+}
+
+/**
+ * @brief original slot format: one packed slot per key. with a 4 byte head the
+ * slot has 8 bytes, the 8 byte head (12 byte slots) resolves more comparisons of
+ * long keys with a common start without touching the key rest
+ */
+template <class HeadType>
+struct PackedSlotsT
+{
+    using Head = HeadType;
+
+    struct PageSlot
+    {
+        u16 offset;
+        u8 headLen;
+        u8 remainderLen;
+        union
+        {
+            Head head;
+            u8 headBytes[sizeof(Head)];
+        };
+    } __attribute__((packed));
+
+    static constexpr const char *name = sizeof(Head) == 4 ? "packed" : "wide";
+    static constexpr bool contiguousHeads = false;
+    static constexpr size_t alignment = 8;
+    static constexpr size_t slotBytes = sizeof(PageSlot);
+
+    template <size_t N>
+    using Array = PageSlot[N];
+
+    static constexpr size_t capacity(size_t bytes) { return bytes / sizeof(PageSlot); }
+    static constexpr size_t areaSize(size_t count) { return count * sizeof(PageSlot); }
+
+    static void moveUp(PageSlot *slot, unsigned from, unsigned count)
+    {
+        memmove(slot + from + 1, slot + from, sizeof(PageSlot) * (count - from));
+    }
+    static void moveDown(PageSlot *slot, unsigned from, unsigned count)
+    {
+        memmove(slot + from, slot + from + 1, sizeof(PageSlot) * (count - from - 1));
+    }
+    static void copy(PageSlot *dst, unsigned dstSlot, PageSlot *src, unsigned srcSlot, unsigned count)
+    {
+        memcpy(dst + dstSlot, src + srcSlot, sizeof(PageSlot) * count);
+    }
+    // moves the slots [from, count) n positions, a negative n moves them down
+    static void shift(PageSlot *slot, unsigned from, unsigned count, int n)
+    {
+        memmove(slot + from + n, slot + from, sizeof(PageSlot) * (count - from));
+    }
+};
+
+using PackedSlots = PackedSlotsT<u32>;
+using WidePackedSlots = PackedSlotsT<u64>;
+
+/**
+ * @brief structure of arrays slot format: slots are grouped in blocks of 16,
+ * every block keeps its heads in one 64 byte aligned cache line followed by the
+ * offsets and lengths. the heads of a block are compared in one avx-512
+ * (or two avx2) instructions, cmpKeys is only needed on head ties.
+ * without avx the block compare falls back to a plain loop.
+ */
+struct BlockedSlots
+{
+    static constexpr unsigned blockSize = 16;
+    using Head = u32;
+
+    struct PageSlot
+    {
+        u16 offset;
+        u8 headLen;
+        u8 remainderLen;
+        u32 head;
+    };
+
+    struct SlotMeta
+    {
+        u16 offset;
+        u8 headLen;
+        u8 remainderLen;
+    };
+
+    struct alignas(64) Block
+    {
+        u32 head[blockSize];
+        SlotMeta meta[blockSize];
+    };
+
+    // reference to one slot scattered over the block, lets the node code use slot[i].head as before
+    struct SlotRef
+    {
+        u16 &offset;
+        u8 &headLen;
+        u8 &remainderLen;
+        u32 &head;
+
+        SlotRef &operator=(const PageSlot &s)
+        {
+            offset = s.offset;
+            headLen = s.headLen;
+            remainderLen = s.remainderLen;
+            head = s.head;
+            return *this;
+        }
+        SlotRef &operator=(const SlotRef &s) { return *this = PageSlot(s); }
+        operator PageSlot() const { return {offset, headLen, remainderLen, head}; }
+    };
+
+    template <size_t N>
+    struct Array
+    {
+        Block block[N / blockSize];
+
+        SlotRef operator[](unsigned i)
+        {
+            Block &b = block[i / blockSize];
+            SlotMeta &m = b.meta[i % blockSize];
+            return {m.offset, m.headLen, m.remainderLen, b.head[i % blockSize]};
+        }
+        PageSlot operator[](unsigned i) const
+        {
+            const Block &b = block[i / blockSize];
+            const SlotMeta &m = b.meta[i % blockSize];
+            return {m.offset, m.headLen, m.remainderLen, b.head[i % blockSize]};
+        }
+    };
+
+    static constexpr const char *name = "blocked";
+    static constexpr bool contiguousHeads = true;
+    static constexpr size_t alignment = alignof(Block);
+    static constexpr size_t slotBytes = sizeof(PageSlot);
+
+    static constexpr size_t capacity(size_t bytes) { return bytes / sizeof(Block) * blockSize; }
+    static constexpr size_t areaSize(size_t count) { return (count + blockSize - 1) / blockSize * sizeof(Block); }
+
+    // shifts the slots [from, count) one position up, the last slot of a block moves to the next block
+    template <class A>
+    static void moveUp(A &slot, unsigned from, unsigned count)
+    {
+        if (from >= count)
+            return;
+        for (unsigned b = (count - 1) / blockSize;; b--)
+        {
+            Block &blk = slot.block[b];
+            unsigned lo = (b == from / blockSize) ? from % blockSize : 0;
+            unsigned hi = min<unsigned>(blockSize, count - b * blockSize);
+            if (hi == blockSize)
+            {
+                slot.block[b + 1].head[0] = blk.head[blockSize - 1];
+                slot.block[b + 1].meta[0] = blk.meta[blockSize - 1];
+                hi--;
+            }
+            memmove(blk.head + lo + 1, blk.head + lo, sizeof(u32) * (hi - lo));
+            memmove(blk.meta + lo + 1, blk.meta + lo, sizeof(SlotMeta) * (hi - lo));
+            if (b == from / blockSize)
+                break;
+        }
+    }
+
+    // shifts the slots [from + 1, count) one position down, overwriting slot from
+    template <class A>
+    static void moveDown(A &slot, unsigned from, unsigned count)
+    {
+        for (unsigned b = from / blockSize; b * blockSize < count; b++)
+        {
+            Block &blk = slot.block[b];
+            unsigned lo = (b == from / blockSize) ? from % blockSize : 0;
+            unsigned hi = min<unsigned>(blockSize, count - b * blockSize);
+            memmove(blk.head + lo, blk.head + lo + 1, sizeof(u32) * (hi - lo - 1));
+            memmove(blk.meta + lo, blk.meta + lo + 1, sizeof(SlotMeta) * (hi - lo - 1));
+            if (hi == blockSize && (b + 1) * blockSize < count)
+            {
+                blk.head[blockSize - 1] = slot.block[b + 1].head[0];
+                blk.meta[blockSize - 1] = slot.block[b + 1].meta[0];
+            }
+        }
+    }
+
+    template <class A>
+    static void copy(A &dst, unsigned dstSlot, A &src, unsigned srcSlot, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++)
+            dst[dstSlot + i] = src[srcSlot + i];
+    }
+
+    // moves the slots [from, count) n positions, a negative n moves them down
+    template <class A>
+    static void shift(A &slot, unsigned from, unsigned count, int n)
+    {
+        if (n > 0)
+            for (unsigned i = count; i-- > from;)
+                slot[i + n] = slot[i];
+        else
+            for (unsigned i = from; i < count; i++)
+                slot[i + n] = slot[i];
+    }
+};
+
+/**
+ * @brief payload length formats of leaf records, chosen at compile time through the config.
+ * a leaf record starts with the length field: the bytes of the payload in the page,
+ * BlobRef::flag marks a payload that is a BlobRef. inner records start with the child instead
+ */
+
+// the original format: the full 8 bytes an inner record spends on its child
+struct WideLengths
+{
+    static constexpr const char *name = "u64";
+    static bool accepts(u64) { return true; }
+    static unsigned size(const u8 *) { return sizeof(u64); }
+    static unsigned sizeOf(u64) { return sizeof(u64); }
+    static u64 load(const u8 *field)
+    {
+        u64 value;
+        memcpy(&value, field, sizeof(u64));
+        return value;
+    }
+    static void store(u8 *field, u64 value) { memcpy(field, &value, sizeof(u64)); }
+};
+
+// 2 bytes, inline payloads never exceed the blob threshold of a 64KB page. the top bit marks a blob
+struct U16Lengths
+{
+    static constexpr const char *name = "u16";
+    static constexpr u16 blobBit = 0x8000;
+    static bool accepts(u64) { return true; }
+    static unsigned size(const u8 *) { return sizeof(u16); }
+    static unsigned sizeOf(u64) { return sizeof(u16); }
+    static u64 load(const u8 *field)
+    {
+        u16 value;
+        memcpy(&value, field, sizeof(u16));
+        return (value & blobBit) ? (BlobRef::flag | (value & ~blobBit)) : value;
+    }
+    static void store(u8 *field, u64 value)
+    {
+        u16 encoded = (value & ~BlobRef::flag) | ((value & BlobRef::flag) ? blobBit : 0);
+        memcpy(field, &encoded, sizeof(u16));
+    }
+};
+
+// LEB128 of length << 1 | blob, one byte for payloads below 64 bytes
+struct VarintLengths
+{
+    static constexpr const char *name = "varint";
+    static bool accepts(u64) { return true; }
+    static unsigned size(const u8 *field)
+    {
+        unsigned n = 1;
+        while (field[n - 1] & 0x80)
+            n++;
+        return n;
+    }
+    static unsigned sizeOf(u64 value)
+    {
+        u64 code = encode(value);
+        unsigned n = 1;
+        while (code >>= 7)
+            n++;
+        return n;
+    }
+    static u64 encode(u64 value) { return ((value & ~BlobRef::flag) << 1) | ((value & BlobRef::flag) ? 1 : 0); }
+    static u64 load(const u8 *field)
+    {
+        u64 code = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            code |= u64(*field & 0x7f) << shift;
+            if (!(*field++ & 0x80))
+                break;
+        }
+        return (code >> 1) | ((code & 1) ? BlobRef::flag : 0);
+    }
+    static void store(u8 *field, u64 value)
+    {
+        u64 code = encode(value);
+        for (; code >= 0x80; code >>= 7)
+            *field++ = u8(code) | 0x80;
+        *field = u8(code);
+    }
+};
+
+// every payload of the tree has Size bytes, the record does not store a length
+template <unsigned Size>
+struct FixedLengths
+{
+    static constexpr const char *name = "fixed";
+    static bool accepts(u64 length) { return length == Size; }
+    static unsigned size(const u8 *) { return 0; }
+    static unsigned sizeOf(u64) { return 0; }
+    static u64 load(const u8 *) { return Size; }
+    static void store(u8 *, u64 value)
+    {
+        assert(value == Size);
+        static_cast<void>(value);
+    }
+};
+
+/**
+ * @brief search layouts, chosen at compile time per node kind through the config.
+ * the sorted slots stay the source of truth and writes always use the sorted search,
+ * the indexed layouts keep a search copy of the heads that is rebuilt lazily after writes.
+ */
+
+// binary search on the sorted slots, narrowed by the hints (simd block search on the blocked slot format)
+struct SortedLayout
+{
+    static constexpr const char *name = "sorted";
+    static constexpr bool indexed = false;
+
+    template <bool equalityOnly, class Node>
+    static unsigned search(Node &node, typename Node::Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        return node.template lowerBoundSorted<equalityOnly>(keyHead, key, keyLength, oldKeyLength);
+    }
+    template <class Node>
+    static void build(Node &) {}
+};
+
+// eytzinger ordered copy of the heads, branchy descent
+struct EytzingerLayout
+{
+    static constexpr const char *name = "eytzinger";
+    static constexpr bool indexed = true;
+
+    template <bool equalityOnly, class Node>
+    static unsigned search(Node &node, typename Node::Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        return node.template lowerBoundEytzinger<equalityOnly>(keyHead, key, keyLength, oldKeyLength);
+    }
+    template <class Node>
+    static void build(Node &node) { node.buildEytzinger(); }
+};
+
+// eytzinger ordered copy of the heads, branchless descent that prefetches the cache line holding the 16 nodes 4 levels down
+struct BranchlessEytzingerLayout
+{
+    static constexpr const char *name = "branchless";
+    static constexpr bool indexed = true;
+
+    template <bool equalityOnly, class Node>
+    static unsigned search(Node &node, typename Node::Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        return node.template lowerBoundEytzingerBranchless<equalityOnly>(keyHead, key, keyLength, oldKeyLength);
+    }
+    template <class Node>
+    static void build(Node &node) { node.buildEytzinger(); }
+};
+
+// copy of the heads as a b-tree of 16 wide blocks inside the page (s-tree), one simd compare per level
+struct STreeLayout
+{
+    static constexpr const char *name = "stree";
+    static constexpr bool indexed = true;
+
+    template <bool equalityOnly, class Node>
+    static unsigned search(Node &node, typename Node::Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        return node.template lowerBoundSTree<equalityOnly>(keyHead, key, keyLength, oldKeyLength);
+    }
+    template <class Node>
+    static void build(Node &node) { node.buildSTree(); }
+};
+
+// layouts of the default config, the build targets of the single layouts override them
+#ifndef BTREE_INNER_LAYOUT
+#define BTREE_INNER_LAYOUT EytzingerLayout
+#endif
+#ifndef BTREE_LEAF_LAYOUT
+#define BTREE_LEAF_LAYOUT SortedLayout
+#endif
+
+// payload length format of the leaf records
+#ifndef BTREE_LEAF_LENGTHS
+#define BTREE_LEAF_LENGTHS U16Lengths
+#endif
+
+// page sizes in bytes, inner nodes and leaves may differ. at most 64KB since slot offsets are 16 bit
+#ifndef BTREE_INNER_PAGE_SIZE
+#define BTREE_INNER_PAGE_SIZE 4096
+#endif
+#ifndef BTREE_LEAF_PAGE_SIZE
+#define BTREE_LEAF_PAGE_SIZE 4096
+#endif
+
+struct DefaultConfig
+{
+    using Slots = PackedSlots;
+    using Addressing = PointerAddressing;
+    using InnerLayout = BTREE_INNER_LAYOUT;
+    using LeafLayout = BTREE_LEAF_LAYOUT;
+    using Lengths = BTREE_LEAF_LENGTHS;
+    static constexpr unsigned innerPageSize = BTREE_INNER_PAGE_SIZE;
+    static constexpr unsigned leafPageSize = BTREE_LEAF_PAGE_SIZE;
+    // inner records carry the record count of their child, for btree_rank and friends
+    static constexpr bool countRecords = false;
+};
+
+struct SimdConfig
+{
+    using Slots = BlockedSlots;
+    using Addressing = PointerAddressing;
+    using InnerLayout = SortedLayout;
+    using LeafLayout = SortedLayout;
+    using Lengths = BTREE_LEAF_LENGTHS;
+    static constexpr unsigned innerPageSize = BTREE_INNER_PAGE_SIZE;
+    static constexpr unsigned leafPageSize = BTREE_LEAF_PAGE_SIZE;
+    static constexpr bool countRecords = false;
+};
+
+// the default config with 8 byte heads in 12 byte slots
+struct WideHeadConfig : DefaultConfig
+{
+    using Slots = WidePackedSlots;
+};
+
+// the default config with 4 byte page ids as children, the nodes live in the NodeArena
+struct NodeIdConfig : DefaultConfig
+{
+    using Addressing = ArenaAddressing;
+};
+
+// the default config with subtree record counts in the inner records, 8 more bytes per separator
+struct CountedConfig : DefaultConfig
+{
+    static constexpr bool countRecords = true;
+};
+
+// the default config with another payload length format
+template <class LeafLengths>
+struct LengthConfig : DefaultConfig
+{
+    using Lengths = LeafLengths;
+};
+
+// the default config with other page sizes
+template <unsigned InnerPageSize, unsigned LeafPageSize>
+struct PageConfig : DefaultConfig
+{
+    static constexpr unsigned innerPageSize = InnerPageSize;
+    static constexpr unsigned leafPageSize = LeafPageSize;
+};
+
+// page sizes of the sweep in test_main, instantiated in btree.cpp
+using Pages8K = PageConfig<8192, 8192>;
+using Pages16K = PageConfig<16384, 16384>;
+using Pages32K = PageConfig<32768, 32768>;
+using Pages64K = PageConfig<65536, 65536>;
+using Inner4KLeaf16K = PageConfig<4096, 16384>;
+using Inner4KLeaf64K = PageConfig<4096, 65536>;
 
+template <class Config>
+struct BTreeNodeT;
 
+/**
+ * @brief page memory of one level of a tree. bytes = slot areas + free + live + fragmented,
+ * compaction turns the fragmented bytes back into free space
+ */
+struct LevelMemory
+{
+    u64 pages = 0;
+    u64 bytes = 0;
+    // keys, values and fences in the heap of the pages (space_used)
+    u64 liveBytes = 0;
+    // space between the slot array and the heap (free_offset slack)
+    u64 freeBytes = 0;
+    // holes in the heap left by removed records
+    u64 fragmentedBytes = 0;
+};
+
+struct MemoryUsage
+{
+    // levels[0] are the leaves, the root is the last level
+    std::vector<LevelMemory> levels;
+    // chunks held by the tree and the pages handed out of them: nodes, search indexes and blob pages
+    u64 chunkBytes = 0;
+    u64 usedBytes = 0;
+};
+
+// one record of the input of btree_bulk_load
+struct BulkRecord
+{
+    uint8_t *key;
+    uint16_t keyLength;
+    uint8_t *value;
+    uint64_t valueLength;
+};
+
+/**
+ * @brief search copy of the heads of a node, pos maps every entry back to its
+ * slot in the sorted slot array. eytzinger layouts are 1-indexed so the 16
+ * nodes 4 levels below node k share the cache line at head + 16k, the s-tree
+ * stores its blocks from head[0].
+ */
+template <size_t N, class Head>
+struct SearchIndex
+{
+    static constexpr size_t capacity = (N + 16) / 16 * 16;
+    alignas(64) Head head[capacity];
+    u16 pos[capacity];
+};
+
+// the record count of the upper child, only the nodes of a config with countRecords have one
+template <bool counted>
+struct UpperRecords
+{
+};
+template <>
+struct UpperRecords<true>
+{
+    u64 upperRecords = 0;
+};
+
+template <class Config>
+struct BTreeNodeHeaderT : UpperRecords<Config::countRecords>
+{
+    static constexpr unsigned innerPageSize = Config::innerPageSize;
+    static constexpr unsigned leafPageSize = Config::leafPageSize;
+    // the node struct is laid out for the larger page, a node only allocates the page of its kind
+    static constexpr unsigned maxPageSize = std::max(innerPageSize, leafPageSize);
+    static_assert(maxPageSize <= (1u << 16), "slot and fence offsets are 16 bit");
+    static constexpr u8 limit = 254;
+    static constexpr u8 marker = 255;
+    // larger values go to blob pages, their length field gets the blob flag
+    static constexpr u64 blobThreshold = leafPageSize / 8;
+    static constexpr u64 blobFlag = BlobRef::flag;
 
     struct FenceKey
     {
@@ -51,131 +662,180 @@ struct BTreeNodeHeader
         u16 length;
     };
 
-    BTreeNode *upper = nullptr;
+    // child reference of the inner records, a pointer or a page id
+    using ChildRef = typename Config::Addressing::template Ref<BTreeNodeT<Config>>;
+
+    ChildRef upper = nullptr;
     FenceKey lower_fence = {0, 0};
     FenceKey upper_fence = {0, 0};
 
     u16 count = 0;
     bool is_leaf;
-    u16 space_used = 0;
-    u16 free_offset = static_cast<u16>(PAGE_SIZE);
+    // a 64KB page does not fit the end of the heap into 16 bit
+    u32 space_used = 0;
+    u32 free_offset;
     u16 prefix_len = 0;
 
     static const unsigned hintCount = 16;
-    u32 hint[hintCount];
+    typename Config::Slots::Head hint[hintCount];
 
-    BTreeNodeHeader(bool isLeaf)
-        : is_leaf(isLeaf) {}
-    ~BTreeNodeHeader() {}
+    BTreeNodeHeaderT(bool isLeaf)
+        : is_leaf(isLeaf), free_offset(isLeaf ? leafPageSize : innerPageSize) {}
+    ~BTreeNodeHeaderT() {}
 
-    bool is_eyt = false;
-    int eyt_i = 0;
-    // int furthest_point_eyt; // in the sorted we can check the max space with: free_offset - (reinterpret_cast<u8 *>(slot + count) - ptr()
-                            //  but in eyt the count is not indicative of the furthest_slot -> this sneaky index
+    // search copy of the heads, only nodes with an indexed layout have one
+    SearchIndex<maxPageSize / Config::Slots::slotBytes, typename Config::Slots::Head> *index = nullptr;
+    bool index_valid = false;
 
     inline u8 *ptr() { return reinterpret_cast<u8 *>(this); }
     inline bool isInner() { return !is_leaf; }
+    inline unsigned pageSize() const { return is_leaf ? leafPageSize : innerPageSize; }
+    // a node with at least this much free space after compaction is merged
+    inline unsigned underFull() const { return pageSize() * 0.6; }
     inline u8 *getLowerFenceKey() { return lower_fence.offset ? ptr() + lower_fence.offset : nullptr; }
     inline u8 *getUpperFenceKey() { return upper_fence.offset ? ptr() + upper_fence.offset : nullptr; }
 };
-struct BTreeNode : public BTreeNodeHeader
+template <class Config>
+struct BTreeNodeT : public BTreeNodeHeaderT<Config>
 {
-
-    struct PageSlot
-    {
-        u16 offset;
-        u8 headLen;
-        u8 remainderLen;
-        union
-        {
-            u32 head;
-            u8 headBytes[4];
-        };
-    } __attribute__((packed));
-    const static size_t slotnum = (PAGE_SIZE - sizeof(BTreeNodeHeader)) / (sizeof(PageSlot));
-
-    __restrict_arr alignas(8) PageSlot slot[slotnum];
+    using BTreeNodeHeader = BTreeNodeHeaderT<Config>;
+    using BTreeNode = BTreeNodeT<Config>;
+    using SwipType = BTreeNode *;
+    using Addressing = typename Config::Addressing;
+    using Pages = PageAllocatorT<Addressing>;
+    using typename BTreeNodeHeader::ChildRef;
+    using Slots = typename Config::Slots;
+    using PageSlot = typename Slots::PageSlot;
+    using Head = typename Slots::Head;
+    using Index = typename std::remove_pointer<decltype(BTreeNodeHeader::index)>::type;
+    using InnerLayout = typename Config::InnerLayout;
+    using LeafLayout = typename Config::LeafLayout;
+    using Lengths = typename Config::Lengths;
+    using typename BTreeNodeHeader::FenceKey;
+    using BTreeNodeHeader::innerPageSize;
+    using BTreeNodeHeader::leafPageSize;
+    using BTreeNodeHeader::maxPageSize;
+    using BTreeNodeHeader::pageSize;
+    using BTreeNodeHeader::underFull;
+    using BTreeNodeHeader::limit;
+    using BTreeNodeHeader::marker;
+    using BTreeNodeHeader::blobThreshold;
+    using BTreeNodeHeader::blobFlag;
+    using BTreeNodeHeader::hintCount;
+    using BTreeNodeHeader::upper;
+    using BTreeNodeHeader::lower_fence;
+    using BTreeNodeHeader::upper_fence;
+    using BTreeNodeHeader::count;
+    using BTreeNodeHeader::is_leaf;
+    using BTreeNodeHeader::space_used;
+    using BTreeNodeHeader::free_offset;
+    using BTreeNodeHeader::prefix_len;
+    using BTreeNodeHeader::hint;
+    using BTreeNodeHeader::index;
+    using BTreeNodeHeader::index_valid;
+    using BTreeNodeHeader::ptr;
+    using BTreeNodeHeader::isInner;
+    using BTreeNodeHeader::getLowerFenceKey;
+    using BTreeNodeHeader::getUpperFenceKey;
+
+    static constexpr bool countRecords = Config::countRecords;
+    // the child of an inner record, followed by the record count below it if the config counts
+    static constexpr unsigned innerHeader = sizeof(ChildRef) + (countRecords ? sizeof(u64) : 0);
+
+    static constexpr size_t slotOffset = (sizeof(BTreeNodeHeader) + Slots::alignment - 1) / Slots::alignment * Slots::alignment;
+    const static size_t slotnum = Slots::capacity(maxPageSize - slotOffset);
+
+    __restrict_arr alignas(Slots::alignment) typename Slots::template Array<slotnum> slot;
+    // slots that do not divide the page leave a tail, the heap starts at the end of the page
+    u8 tail[maxPageSize - slotOffset - sizeof(slot)];
 
     int get_times()
     {
         return times;
     }
-    void eytzinger(const PageSlot *sortedArray, PageSlot *eytzingerArray, int n, int k = 1)
+    // fills the search index in 1-indexed eytzinger order from the sorted slots, each node computes its sorted position directly
+    void buildEytzinger()
     {
-        if (k <= n)
-        {
-            eytzinger(sortedArray, eytzingerArray, n, 2 * k);
-            eytzingerArray[k] = sortedArray[eyt_i++];
-            eytzinger(sortedArray, eytzingerArray, n, 2 * k + 1);
-        }
+        forEachEytzinger(count, [&](unsigned k, unsigned r)
+                         {
+                             index->head[k] = slot[r].head;
+                             index->pos[k] = r; });
+        assert(checkEytzingerLayout(index->head + 1, count));
     }
 
-    // Wrapper function
-    void convertToEytzinger(__restrict_arr PageSlot *sortedArray, int n)
-    {
-        if (n == 0)
-            return;
-        __restrict_arr PageSlot eytzingerArray[n + 1]; // = new PageSlot[n + 1];
-        eyt_i = 0;
-        // __builtin_prefetch(sortedArray);
-        eytzinger(sortedArray, eytzingerArray, n);
-        std::copy(eytzingerArray + 1, eytzingerArray + n + 1, sortedArray);
-        // memcpy(sortedArray,eytzingerArray+1,n* sizeof(PageSlot));
-        // delete[] eytzingerArray;
-        is_eyt = true;
-        assert(checkEytzingerLayout(slot, count));
-        times++;
-        return;
-    }
-
-    void fromEytzingerLayout(const PageSlot *eytzingerArray, PageSlot *sortedArray, int index, int n)
+    /**
+     * @brief fills the search index as an s-tree: blocks of 16 heads, block k has the
+     * children k * 17 + i + 1. the blocks are filled by an in-order walk with an
+     * explicit stack, unused entries get the largest head and point past the last slot
+     */
+    void buildSTree()
     {
-        if (index >= n)
+        constexpr unsigned B = 16;
+        unsigned blocks = (count + B - 1) / B;
+        struct Frame
         {
-            return;
+            unsigned block, i;
+        } stack[16];
+        unsigned depth = 0;
+        auto descend = [&](unsigned k)
+        {
+            for (; k < blocks; k = k * (B + 1) + 1)
+                stack[depth++] = {k, 0};
+        };
+        unsigned t = 0;
+        descend(0);
+        while (depth)
+        {
+            Frame &f = stack[depth - 1];
+            if (f.i == B)
+            {
+                depth--;
+                continue;
+            }
+            unsigned e = f.block * B + f.i++;
+            index->head[e] = t < count ? Head(slot[t].head) : Head(~Head(0));
+            index->pos[e] = t < count ? t : count;
+            t++;
+            descend(f.block * (B + 1) + f.i + 1);
         }
-        fromEytzingerLayout(eytzingerArray, sortedArray, 2 * index + 1, n);
-        sortedArray[eyt_i++] = eytzingerArray[index];
-        fromEytzingerLayout(eytzingerArray, sortedArray, 2 * index + 2, n);
     }
 
-    // Wrapper function
-    void convertFromEytzinger(__restrict_arr PageSlot *eytzingerArray, int n, PageSlot tmp)
+    /**
+     * @brief rebuilds the search copy of the node if a write invalidated it.
+     * the sorted slots stay the source of truth, writes only clear index_valid
+     */
+    template <class Layout>
+    void updateIndex()
     {
-        if (n == 0)
+        if (index_valid)
             return;
-
-        __restrict_arr PageSlot sortedArray[n]; // = new PageSlot[n];
-        eyt_i = 0;
-        // __builtin_prefetch(eytzingerArray);
-        fromEytzingerLayout(eytzingerArray, sortedArray, 0, n);
-        std::copy(sortedArray, sortedArray + n, eytzingerArray);
-        // memcpy(eytzingerArray,sortedArray,n * sizeof(PageSlot));
-        slot[count] = tmp;
-        // delete[] sortedArray;
-        is_eyt = false;
+        if (!index)
+            index = new (Pages::of(this)->allocate(sizeof(Index))) Index;
+        Layout::build(*this);
+        index_valid = true;
         times++;
-        assert(isSorted(eytzingerArray,count));
     }
 
-    bool isEytzingerLayout(const PageSlot *array, int index, int n)
+    void invalidateIndex() { index_valid = false; }
+
+    bool isEytzingerLayout(const Head *array, int index, int n)
     {
         int leftChildIndex = 2 * index + 1;
         int rightChildIndex = 2 * index + 2;
         if (leftChildIndex >= n)
             return true;
-        if (rightChildIndex >= n && array[leftChildIndex].head < array[index].head)
+        if (rightChildIndex >= n && array[leftChildIndex] < array[index])
             return true;
 
         // Check if left child exists and if its key is less than or equal to the parent's key
-        if (leftChildIndex < n && array[leftChildIndex].head > array[index].head)
+        if (leftChildIndex < n && array[leftChildIndex] > array[index])
         {
             std::cout << "The array is wrong at " << index << "and  the left is " << leftChildIndex << std::endl;
             return false;
         }
 
         // Check if right child exists and if its key is greater than or equal to the parent's key
-        if (rightChildIndex < n && array[rightChildIndex].head < array[index].head)
+        if (rightChildIndex < n && array[rightChildIndex] < array[index])
         {
             std::cout << "The array is wrong at " << index << "and  the right is " << rightChildIndex << std::endl;
 
@@ -188,14 +848,17 @@ struct BTreeNode : public BTreeNodeHeader
     }
 
     // Wrapper function to start from the root
-    bool checkEytzingerLayout(const PageSlot *array, int n)
+    bool checkEytzingerLayout(const Head *array, int n)
     {
         if (n == 0)
             return true; // Empty array is trivially in Eytzinger layout
         return isEytzingerLayout(array, 0, n);
     }
 
-    bool isSorted(const PageSlot *array, int n)
+    bool isSorted() { return isSorted(slot, count); }
+
+    template <class Array>
+    bool isSorted(const Array &array, int n)
     {
         for (int i = 1; i < n; ++i)
         {
@@ -215,7 +878,7 @@ struct BTreeNode : public BTreeNodeHeader
                                                                isLarge(i) ? getRestLenLarge(i) : getRemainderLength(i)) > 0))
             {
 
-                cout << "At the index: " << i << " and the cpunt " << count << " is_eyt " << is_eyt << endl;
+                cout << "At the index: " << i << " and the cpunt " << count << endl;
                 cout << "arr[" << i << "]: " << +array[i].head << " arr[" << i - 1 << "]: " << +array[i - 1].head << endl;
                 cout << "arr[" << i << "].remainderLen: " << +array[i].remainderLen << " arr[" << i - 1 << "]remainderLen: " << +array[i - 1].remainderLen << endl;
 
@@ -229,17 +892,17 @@ struct BTreeNode : public BTreeNodeHeader
         }
         return true;
     }
-    BTreeNode(bool is_leaf)
+    BTreeNodeT(bool is_leaf)
         : BTreeNodeHeader(is_leaf)
     {
-        for (size_t i = 0; i < slotnum; i++)
-        {
-            slot[i] = {0, 0, 0, {0}};
-        }
+        static_assert(sizeof(BTreeNode) == maxPageSize, "the node struct has to cover the page");
+        // the slots are not cleared, nothing reads a slot at or above count
     }
 
-    unsigned freeSpace() { return free_offset - (reinterpret_cast<u8 *>(slot + count) - ptr()); }
-    unsigned spacePostCompact() { return PAGE_SIZE - (reinterpret_cast<u8 *>(slot + count) - ptr()) - space_used; }
+    // end of the slot area, with the blocked format the next slot may need a whole new block
+    static unsigned slotAreaEnd(unsigned n) { return slotOffset + Slots::areaSize(n); }
+    unsigned freeSpace() { return max<int>(0, int(free_offset) - int(slotAreaEnd(count + 1) - Slots::slotBytes)); }
+    unsigned spacePostCompact() { return max<int>(0, int(pageSize()) - int(slotAreaEnd(count + 1) - Slots::slotBytes) - int(space_used)); }
 
     bool allocateSpace(unsigned spaceNeeded)
     {
@@ -254,12 +917,31 @@ struct BTreeNode : public BTreeNodeHeader
         return false;
     }
 
-    static BTreeNode *makeLeaf() { return new BTreeNode(true); }
-    static BTreeNode *makeInner() { return new BTreeNode(false); }
+    // nodes only allocate the page of their kind, the rest of the struct is never touched
+    static BTreeNode *allocate(Pages &pages, bool isLeaf)
+    {
+        static_assert(alignof(BTreeNode) <= Pages::unit, "pages are only aligned to the allocation unit");
+        return new (pages.allocate(isLeaf ? leafPageSize : innerPageSize)) BTreeNode(isLeaf);
+    }
+    // frees the page of the node and its search index to the tree they came from
+    static void release(BTreeNode *node)
+    {
+        Pages *pages = Pages::of(node);
+        if (node->index)
+            pages->release(node->index, sizeof(Index));
+        pages->release(node, node->pageSize());
+    }
+
+    static BTreeNode *makeLeaf(Pages &pages) { return allocate(pages, true); }
+    static BTreeNode *makeInner(Pages &pages) { return allocate(pages, false); }
+    // a page from the end of the newest chunk, the nodes a bulk load writes one after another get consecutive pages
+    static BTreeNode *allocateFresh(Pages &pages, bool isLeaf) { return new (pages.allocateFresh(isLeaf ? leafPageSize : innerPageSize)) BTreeNode(isLeaf); }
+    // bytes in front of the key rest: the child of an inner record, the length field of a leaf record
+    inline unsigned recordHeader(unsigned slot_id) { return is_leaf ? Lengths::size(ptr() + slot[slot_id].offset) : innerHeader; }
     inline u8 *getRest(unsigned slot_id)
     {
         assert(!isLarge(slot_id));
-        return ptr() + slot[slot_id].offset + sizeof(SwipType);
+        return ptr() + slot[slot_id].offset + recordHeader(slot_id);
     }
     inline unsigned getRemainderLength(unsigned slot_id)
     {
@@ -269,18 +951,18 @@ struct BTreeNode : public BTreeNodeHeader
     inline u8 *getPayload(unsigned slot_id)
     {
         assert(!isLarge(slot_id));
-        return ptr() + slot[slot_id].offset + sizeof(SwipType) + getRemainderLength(slot_id);
+        return getRest(slot_id) + getRemainderLength(slot_id);
     }
 
     inline u8 *getRemainderLarge(unsigned slot_id)
     {
         assert(isLarge(slot_id));
-        return ptr() + slot[slot_id].offset + sizeof(SwipType) + sizeof(u16);
+        return ptr() + slot[slot_id].offset + recordHeader(slot_id) + sizeof(u16);
     }
     inline u16 &getRestLenLarge(unsigned slot_id)
     {
         assert(isLarge(slot_id));
-        return *reinterpret_cast<u16 *>(ptr() + slot[slot_id].offset + sizeof(SwipType));
+        return *reinterpret_cast<u16 *>(ptr() + slot[slot_id].offset + recordHeader(slot_id));
     }
     inline bool isLarge(unsigned slot_id) { return slot[slot_id].remainderLen == marker; }
     inline void setLarge(unsigned slot_id) { slot[slot_id].remainderLen = marker; }
@@ -288,11 +970,61 @@ struct BTreeNode : public BTreeNodeHeader
     inline u8 *getPayloadLarge(unsigned slot_id)
     {
         assert(isLarge(slot_id));
-        return ptr() + slot[slot_id].offset + sizeof(SwipType) + sizeof(u16) + getRestLenLarge(slot_id);
+        return getRemainderLarge(slot_id) + getRestLenLarge(slot_id);
     }
 
-    inline u64 getPayloadLength(unsigned slot_id) { return *reinterpret_cast<u64 *>(ptr() + slot[slot_id].offset); }
-    inline SwipType &getChild(unsigned slot_id) { return *reinterpret_cast<SwipType *>(ptr() + slot[slot_id].offset); }
+    // the length field of a leaf record, the payload bytes in the page with the blob flag
+    inline u64 getLengthField(unsigned slot_id) { return Lengths::load(ptr() + slot[slot_id].offset); }
+    static u64 payloadSpace(u64 lengthField) { return lengthField & ~blobFlag; }
+    static bool acceptsPayload(u64 payloadLength) { return Lengths::accepts(payloadLength); }
+    inline bool isBlob(unsigned slot_id) { return getLengthField(slot_id) & blobFlag; }
+    inline u8 *getValue(unsigned slot_id) { return isLarge(slot_id) ? getPayloadLarge(slot_id) : getPayload(slot_id); }
+    inline BlobRef *getBlobRef(unsigned slot_id) { return reinterpret_cast<BlobRef *>(getValue(slot_id)); }
+    inline BlobPage *getBlob(unsigned slot_id) { return getBlobRef(slot_id)->first; }
+    inline u64 getPayloadLength(unsigned slot_id)
+    {
+        u64 field = getLengthField(slot_id);
+        return (field & blobFlag) ? getBlobRef(slot_id)->length : field;
+    }
+    inline ValueView getValueView(unsigned slot_id)
+    {
+        u64 field = getLengthField(slot_id);
+        if (field & blobFlag)
+            return ValueView{nullptr, getBlob(slot_id), getBlobRef(slot_id)->length};
+        return ValueView{getValue(slot_id), nullptr, field};
+    }
+    inline ChildRef &getChild(unsigned slot_id)
+    {
+        assert(isInner());
+        return *reinterpret_cast<ChildRef *>(ptr() + slot[slot_id].offset);
+    }
+    // the record count below the child of inner record slot_id
+    inline u64 &entryRecords(unsigned slot_id)
+    {
+        assert(isInner());
+        return *reinterpret_cast<u64 *>(ptr() + slot[slot_id].offset + sizeof(ChildRef));
+    }
+    // the record count below child pos, count is the upper child
+    inline u64 &childRecords(unsigned pos) { return pos < count ? entryRecords(pos) : this->upperRecords; }
+    // records in the subtree of this node, from the counts of its children
+    u64 records()
+    {
+        if (is_leaf)
+            return count;
+        u64 sum = this->upperRecords;
+        for (unsigned i = 0; i < count; i++)
+            sum += entryRecords(i);
+        return sum;
+    }
+    // sets every count below this node from the leaves up, returns the records of the subtree
+    u64 recount()
+    {
+        if (is_leaf)
+            return count;
+        for (unsigned i = 0; i <= count; i++)
+            childRecords(i) = (i < count ? getChild(i) : upper)->recount();
+        return records();
+    }
     inline unsigned getFullKeyLength(unsigned slot_id) { return prefix_len + slot[slot_id].headLen + (isLarge(slot_id) ? getRestLenLarge(slot_id) : getRemainderLength(slot_id)); }
 
     inline void copyKeyOut(unsigned slot_id, u8 *out, unsigned key_len)
@@ -301,44 +1033,32 @@ struct BTreeNode : public BTreeNodeHeader
         out += prefix_len;
         key_len -= prefix_len;
 
-        auto &current_slot = slot[slot_id];
+        auto &&current_slot = slot[slot_id];
         auto headLen = current_slot.headLen;
 
-        if (key_len >= headLen)
+        // short keys only get their head bytes, out may be shorter than the head
+        Head head = swap(Head(current_slot.head));
+        if (headLen == sizeof(Head) && key_len >= headLen)
         {
-            *reinterpret_cast<u32 *>(out) = swap(current_slot.head);
+            memcpy(out, &head, sizeof(Head));
             memcpy(out + headLen, (isLarge(slot_id) ? getRemainderLarge(slot_id) : getRest(slot_id)), key_len - headLen);
         }
         else
         {
-            switch (headLen)
-            {
-            case 4:
-                *reinterpret_cast<u32 *>(out) = swap(current_slot.head);
-                break;
-            case 3:
-                out[2] = current_slot.headBytes[1]; // fallthrough
-            case 2:
-                out[1] = current_slot.headBytes[2]; // fallthrough
-            case 1:
-                out[0] = current_slot.headBytes[3]; // fallthrough
-            case 0:
-                break;
-            default:
-                __builtin_unreachable();
-            };
+            memcpy(out, &head, min<unsigned>(headLen, key_len));
         }
     }
 
-    static unsigned spaceNeeded(unsigned key_len, unsigned prefix_len)
+    // space of an inner record, a leaf record passes the size of its length field as header
+    static unsigned spaceNeeded(unsigned key_len, unsigned prefix_len, unsigned header = innerHeader)
     {
         assert(key_len >= prefix_len);
         auto restLen = key_len - prefix_len;
-        if (restLen <= sizeof(u32))
-            return sizeof(PageSlot) + sizeof(SwipType);
-        restLen -= sizeof(u32);
+        if (restLen <= sizeof(Head))
+            return Slots::slotBytes + header;
+        restLen -= sizeof(Head);
         auto additional = (restLen > limit) ? sizeof(u16) : 0;
-        return sizeof(PageSlot) + restLen + sizeof(SwipType) + additional;
+        return Slots::slotBytes + restLen + header + additional;
     }
 
     static int cmpKeys(u8 *keyA, u8 *keyB, unsigned lengthA, unsigned lengthB)
@@ -349,118 +1069,138 @@ struct BTreeNode : public BTreeNodeHeader
         return (lengthA - lengthB);
     }
 
-    static u32 extractKeyHead(u8 *&currentKey, unsigned &remainingLength)
+    static Head extractKeyHead(u8 *&currentKey, unsigned &remainingLength)
     {
-        u32 extractedValue;
-        if (remainingLength > 3)
+        Head extractedValue = 0;
+        if (remainingLength >= sizeof(Head))
         {
-            extractedValue = swap(*reinterpret_cast<u32 *>(currentKey));
-            currentKey += sizeof(u32);
-            remainingLength -= sizeof(u32);
-            return extractedValue;
+            memcpy(&extractedValue, currentKey, sizeof(Head));
+            currentKey += sizeof(Head);
+            remainingLength -= sizeof(Head);
+            return swap(extractedValue);
         }
-
-        // Handling cases where the key length is less than 4
+        // an empty rest may come with a null key, memcpy must not see it
         if (remainingLength == 0)
-        {
-            extractedValue = 0;
-        }
-        else if (remainingLength == 1)
-        {
-            extractedValue = static_cast<u32>(currentKey[0]) << 24;
-        }
-        else if (remainingLength == 2)
-        {
-            extractedValue = static_cast<u32>(swap(*reinterpret_cast<u16 *>(currentKey))) << 16;
-        }
-        else // remainingLength == 3
-        {
-            extractedValue = (static_cast<u32>(swap(*reinterpret_cast<u16 *>(currentKey))) << 16) | (static_cast<u32>(currentKey[2]) << 8);
-        }
+            return 0;
 
+        // keys shorter than the head are padded with zeros
+        memcpy(&extractedValue, currentKey, remainingLength);
         remainingLength = 0;
-        return extractedValue;
+        return swap(extractedValue);
     }
 
     void makeHint()
     {
+        if constexpr (Slots::contiguousHeads)
+            return;
         unsigned dist = count / (hintCount + 1);
         for (unsigned i = 0; i < hintCount; i++)
             hint[i] = slot[dist * (i + 1)].head;
     }
 
-    template <bool equalityOnly = false>
-    unsigned lowerBoundEytzinger_1_indexed(u8 *key, unsigned keyLength)
+    /**
+     * @brief strips the node prefix from the key. returns false if the prefix
+     * alone decides the search, pos then holds the result
+     */
+    template <bool equalityOnly>
+    bool stripPrefix(u8 *&key, unsigned &keyLength, unsigned &pos)
     {
-        PageSlot arr_tmp[count + 1];
-        std::copy(slot, slot + count, arr_tmp + 1);
-
         if (equalityOnly)
         {
             if ((keyLength < prefix_len) || (bcmp(key, getLowerFenceKey(), prefix_len) != 0))
-                return -1;
+            {
+                pos = -1;
+                return false;
+            }
         }
         else
         {
             int prefixCmp = cmpKeys(key, getLowerFenceKey(), min<unsigned>(keyLength, prefix_len), prefix_len);
             if (prefixCmp < 0)
             {
-                return findSmallestChildEyt(count);
+                pos = 0;
+                return false;
             }
-
             else if (prefixCmp > 0)
             {
-                return findSmallestChildEyt(count)-1;
+                pos = count;
+                return false;
             }
         }
         key += prefix_len;
         keyLength -= prefix_len;
+        return true;
+    }
 
+    template <class Layout, bool equalityOnly>
+    unsigned searchWith(u8 *key, unsigned keyLength)
+    {
+        unsigned pos;
+        if (!stripPrefix<equalityOnly>(key, keyLength, pos))
+            return pos;
         unsigned oldKeyLength = keyLength;
-        u32 keyHead = extractKeyHead(key, keyLength);
+        Head keyHead = extractKeyHead(key, keyLength);
+        if constexpr (Layout::indexed)
+            updateIndex<Layout>();
+        return Layout::template search<equalityOnly>(*this, keyHead, key, keyLength, oldKeyLength);
+    }
+
+    // search with the layout configured for this node kind, used by lookups
+    template <bool equalityOnly = false>
+    unsigned search(u8 *key, unsigned keyLength)
+    {
+        if (is_leaf)
+            return searchWith<LeafLayout, equalityOnly>(key, keyLength);
+        return searchWith<InnerLayout, equalityOnly>(key, keyLength);
+    }
+
+    // the lines a search of this node reads first past the header: the prefix in the lower fence and the top of the search index
+    void prefetchSearch()
+    {
+        if (prefix_len)
+            __builtin_prefetch(getLowerFenceKey());
+        if ((is_leaf ? LeafLayout::indexed : InnerLayout::indexed) && index_valid)
+            __builtin_prefetch(index->head);
+    }
+    void prefetchRecord(unsigned slot_id) { __builtin_prefetch(ptr() + slot[slot_id].offset); }
+
+    // search on the sorted slots, used by writes since it never needs the search index
+    template <bool equalityOnly = false>
+    unsigned lowerBound(u8 *key, unsigned keyLength)
+    {
+        return searchWith<SortedLayout, equalityOnly>(key, keyLength);
+    }
 
+    // true if the key belongs left of index entry k, equal keys go left so the search ends on them
+    bool lowerBoundBranchless(Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength, unsigned k)
+    {
+        COUNT_HEAD_STAT(compares);
+        if (index->head[k] != keyHead)
+            return keyHead < index->head[k];
+        return cmpSlotRest(index->pos[k], key, keyLength, oldKeyLength) <= 0;
+    }
+
+    template <bool equalityOnly = false>
+    unsigned lowerBoundEytzinger(Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        Head *head = index->head;
+        u16 *pos = index->pos;
         size_t k = 1;
         // full binary search
         while (k <= count)
         {
-            __builtin_prefetch(arr_tmp + k * 8);
-            if (arr_tmp[k].head > keyHead)
+            COUNT_HEAD_STAT(compares);
+            if (head[k] > keyHead)
             {
                 k = 2 * k;
             }
-
-            else if ((arr_tmp[k].head < keyHead))
+            else if ((head[k] < keyHead))
             {
                 k = 2 * k + 1;
             }
-
-            else if (arr_tmp[k].remainderLen == 0)
-            {
-                if (oldKeyLength < arr_tmp[k].headLen)
-                {
-                    k = 2 * k;
-                }
-                else if (oldKeyLength > arr_tmp[k].headLen)
-                {
-                    k = 2 * k + 1;
-                }
-                else
-                {
-                    return k - 1;
-                }
-            }
             else
             {
-                int cmp;
-                if (isLarge(k - 1))
-                {
-                    cmp = cmpKeys(key, getRemainderLarge(k - 1), keyLength, getRestLenLarge(k - 1));
-                }
-                else
-                {
-                    cmp = cmpKeys(key, getRest(k - 1), keyLength, getRemainderLength(k - 1));
-                }
-
+                int cmp = cmpSlotRest(pos[k], key, keyLength, oldKeyLength);
                 if (cmp < 0)
                 {
                     k = 2 * k;
@@ -471,8 +1211,7 @@ struct BTreeNode : public BTreeNodeHeader
                 }
                 else
                 {
-
-                    return k - 1;
+                    return pos[k];
                 }
             }
         }
@@ -480,227 +1219,78 @@ struct BTreeNode : public BTreeNodeHeader
         if (equalityOnly)
             return -1;
         k >>= __builtin_ffs(~k);
-
-        return k - 1;
+        return k == 0 ? count : pos[k];
     }
 
-    bool lowerBoundBranchless(u32 keyHead, u8 *key, unsigned keyLength, unsigned k)
+    template <bool equalityOnly = false>
+    unsigned lowerBoundEytzingerBranchless(Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
     {
-        if (slot[k].head > keyHead)
-        {
-            return true;
-        }
-
-        else if ((slot[k].head < keyHead))
+        size_t k = 1;
+        while (k <= count)
         {
-            return false;
+            __builtin_prefetch(index->head + k * 16);
+            k = 2 * k + !lowerBoundBranchless(keyHead, key, keyLength, oldKeyLength, k);
         }
+        k >>= __builtin_ffs(~k);
+        if (equalityOnly)
+            return (k == 0 || cmpSlot(index->pos[k], key, keyLength, oldKeyLength, keyHead) != 0) ? -1 : index->pos[k];
+        return k == 0 ? count : index->pos[k];
+    }
 
-        else if (slot[k].remainderLen == 0)
-        {
-            if (keyLength < slot[k].headLen)
-            {
-                return false;
-            }
-            else if (keyLength > slot[k].headLen)
-            {
-                return true;
-            }
-        }
-        else
+    // sorted position of the first head >= keyHead, one simd compare per s-tree level
+    unsigned sTreeHeadBound(Head keyHead)
+    {
+        constexpr unsigned B = 16;
+        unsigned blocks = (count + B - 1) / B;
+        unsigned res = count;
+        for (unsigned k = 0; k < blocks;)
         {
-            int cmp;
-            if (isLarge(k))
-            {
-                cmp = cmpKeys(key, getRemainderLarge(k), keyLength, getRestLenLarge(k));
-            }
-            else
-            {
-                cmp = cmpKeys(key, getRest(k), keyLength, getRemainderLength(k));
-            }
-
-            if (cmp < 0)
-            {
-                return true;
-            }
-            else if (cmp > 0)
-            {
-                return false;
-            }
-            
+            COUNT_HEAD_STAT(compares);
+            unsigned i = __builtin_popcount(maskBelow<false>(index->head + k * B, keyHead));
+            if (i < B)
+                res = index->pos[k * B + i];
+            k = k * (B + 1) + i + 1;
         }
-        return false;
+        return res;
     }
+
     template <bool equalityOnly = false>
-    unsigned lowerBoundEytzinger(u8 *key, unsigned keyLength)
+    unsigned lowerBoundSTree(Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
     {
-        if (equalityOnly)
-        {
-            if ((keyLength < prefix_len) || (bcmp(key, getLowerFenceKey(), prefix_len) != 0))
-                return -1;
-        }
-        else
-        {
-            int prefixCmp = cmpKeys(key, getLowerFenceKey(), min<unsigned>(keyLength, prefix_len), prefix_len);
-            if (prefixCmp < 0)
-            {
-                return findSmallestChildEyt(count);
-            }
-
-            else if (prefixCmp > 0)
-            {
-                return findSmallestChildEyt(count) - 1; //defacto biggest
-            }
-        }
-        key += prefix_len;
-        keyLength -= prefix_len;
-
-        unsigned oldKeyLength = keyLength;
-        u32 keyHead = extractKeyHead(key, keyLength);
-
-        size_t k = 0;
-        // full binary search
-        while (k < count)
-        {
-            // __builtin_prefetch(slot + k * (64/sizeof(PageSlot)));
-            // __builtin_prefetch(slot + k * (64/sizeof(PageSlot)) + 64);
-
-            if (slot[k].head > keyHead)
-            {
-                k = 2 * k + 1;
-            }
-
-            else if ((slot[k].head < keyHead))
-            {
-                k = 2 * k + 2;
-            }
-
-            else if (slot[k].remainderLen == 0)
-            {
-                if (oldKeyLength < slot[k].headLen)
-                {
-                    k = 2 * k + 1;
-                }
-                else if (oldKeyLength > slot[k].headLen)
-                {
-                    k = 2 * k + 2;
-                }
-                else
-                {
-                    return k;
-                }
-            }
-            else
-            {
-                int cmp;
-                if (isLarge(k))
-                {
-                    // __builtin_prefetch(ptr() + slot[k].offset + sizeof(SwipType) + sizeof(u16));
-
-                    cmp = cmpKeys(key, getRemainderLarge(k), keyLength, getRestLenLarge(k));
-                }
-                else
-                {
-                    // __builtin_prefetch(ptr() + slot[k].offset + sizeof(SwipType));
-
-                    cmp = cmpKeys(key, getRest(k), keyLength, getRemainderLength(k));
-                }
-                // cout << "[DEBUG]: large branch " << cmp << " and " << k << " and " << arr_tmp[k].offset << endl;
-
-                if (cmp < 0)
-                {
-                    k = 2 * k + 1;
-                }
-                else if (cmp > 0)
-                {
-                    k = 2 * k + 2;
-                }
-                else
-                {
-
-                    return k;
-                }
-            }
-        }
-        // there is no exact match
-        if (equalityOnly)
-            return -1;
-        auto j = (k + 1) >> __builtin_ffs(~(k + 1));
-
-        return j == 0 ? count : j - 1;
+        unsigned lower = sTreeHeadBound(keyHead);
+        if (lower == count || slot[lower].head != keyHead)
+            return equalityOnly ? -1 : lower;
+        unsigned upper = keyHead == Head(~Head(0)) ? count : sTreeHeadBound(keyHead + 1);
+        return lowerBoundHeadTie<equalityOnly>(lower, upper, key, keyLength, oldKeyLength);
     }
 
+    // binary search over the slots [lower, upper) that all have the head of the key
     template <bool equalityOnly = false>
-    unsigned lowerBoundEytzinger_branchless(u8 *key, unsigned keyLength)
+    unsigned lowerBoundHeadTie(unsigned lower, unsigned upper, u8 *key, unsigned keyLength, unsigned oldKeyLength)
     {
-
-        if (equalityOnly)
-        {
-            if ((keyLength < prefix_len) || (bcmp(key, getLowerFenceKey(), prefix_len) != 0))
-                return -1;
-        }
-        else
-        {
-            int prefixCmp = cmpKeys(key, getLowerFenceKey(), min<unsigned>(keyLength, prefix_len), prefix_len);
-            if (prefixCmp < 0)
-            {
-                return 0;
-            }
-
-            else if (prefixCmp > 0)
-            {
-                return count;
-            }
-        }
-        key += prefix_len;
-        keyLength -= prefix_len;
-        u32 keyHead = extractKeyHead(key, keyLength);
-
-        size_t k = 0;
-        // full binary search
-        while (k < count)
+        while (lower < upper)
         {
-            __builtin_prefetch(slot + k * 16);
-            k = lowerBoundBranchless(keyHead, key, keyLength, k) ? 2 * k + 1 : 2 * k + 2;
+            unsigned mid = ((upper - lower) / 2) + lower;
+            int cmp = cmpSlotRest(mid, key, keyLength, oldKeyLength);
+            if (cmp < 0)
+                upper = mid;
+            else if (cmp > 0)
+                lower = mid + 1;
+            else
+                return mid;
         }
-        // there is no exact match
-        if (equalityOnly)
-            return -1;
-        auto j = (k + 1) >> __builtin_ffs(~(k + 1));
-
-        return j == 0 ? count : j - 1;
+        return equalityOnly ? -1 : lower;
     }
 
     template <bool equalityOnly = false>
-    unsigned lowerBound(u8 *key, unsigned keyLength)
+    unsigned lowerBoundSorted(Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
     {
-        if (equalityOnly)
-        {
-            if ((keyLength < prefix_len) || (bcmp(key, getLowerFenceKey(), prefix_len) != 0))
-            {
-                return -1;
-            }
-        }
-        else
-        {
-            int prefixCmp = cmpKeys(key, getLowerFenceKey(), min<unsigned>(keyLength, prefix_len), prefix_len);
-            if (prefixCmp < 0)
-            {
-
-                return 0;
-            }
-            else if (prefixCmp > 0)
-                return count;
-        }
-        key += prefix_len;
-        keyLength -= prefix_len;
+        if constexpr (Slots::contiguousHeads)
+            return lowerBoundBlocked<equalityOnly>(keyHead, key, keyLength, oldKeyLength);
 
         unsigned lower = 0;
         unsigned upper = count;
 
-        unsigned oldKeyLength = keyLength;
-        u32 keyHead = extractKeyHead(key, keyLength);
-
         // searching with hints
         if (count > hintCount * 2)
         {
@@ -722,6 +1312,7 @@ struct BTreeNode : public BTreeNodeHeader
         while (lower < upper)
         {
             unsigned mid = ((upper - lower) / 2) + lower;
+            COUNT_HEAD_STAT(compares);
             if (keyHead < slot[mid].head)
             {
                 upper = mid;
@@ -732,6 +1323,7 @@ struct BTreeNode : public BTreeNodeHeader
             }
             else if (slot[mid].remainderLen == 0)
             {
+                COUNT_HEAD_STAT(ties);
                 if (oldKeyLength < slot[mid].headLen)
                 {
                     upper = mid;
@@ -747,6 +1339,7 @@ struct BTreeNode : public BTreeNodeHeader
             }
             else
             {
+                COUNT_HEAD_STAT(ties);
                 int cmp;
                 if (isLarge(mid))
                 {
@@ -776,8 +1369,82 @@ struct BTreeNode : public BTreeNodeHeader
         return lower;
     }
 
+    // compares the key rest with slot k after their heads were found equal
+    int cmpSlotRest(unsigned k, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        COUNT_HEAD_STAT(ties);
+        if (slot[k].remainderLen == 0)
+            return int(oldKeyLength) - int(slot[k].headLen);
+        if (isLarge(k))
+            return cmpKeys(key, getRemainderLarge(k), keyLength, getRestLenLarge(k));
+        return cmpKeys(key, getRest(k), keyLength, getRemainderLength(k));
+    }
+
+    // full comparison of the key with slot k
+    int cmpSlot(unsigned k, u8 *key, unsigned keyLength, unsigned oldKeyLength, Head keyHead)
+    {
+        COUNT_HEAD_STAT(compares);
+        if (slot[k].head != keyHead)
+            return keyHead < slot[k].head ? -1 : 1;
+        return cmpSlotRest(k, key, keyLength, oldKeyLength);
+    }
+
+    // heads of the block b that belong to live slots
+    u32 validMask(unsigned b)
+    {
+        unsigned valid = min<unsigned>(Slots::blockSize, count - b * Slots::blockSize);
+        return (1u << valid) - 1;
+    }
+
+    /**
+     * @brief lowerBound on the blocked format: a binary search over the last
+     * head of every block picks the block, one simd compare finds the first
+     * head >= keyHead inside it. only slots with a head equal to keyHead
+     * are compared with cmpKeys.
+     */
+    template <bool equalityOnly = false>
+    unsigned lowerBoundBlocked(Head keyHead, u8 *key, unsigned keyLength, unsigned oldKeyLength)
+    {
+        constexpr unsigned B = Slots::blockSize;
+        if (count == 0)
+            return equalityOnly ? -1 : 0;
+        unsigned blocks = (count + B - 1) / B;
+        unsigned lowBlock = 0, highBlock = blocks;
+        while (lowBlock < highBlock)
+        {
+            unsigned mid = (lowBlock + highBlock) / 2;
+            unsigned last = min<unsigned>((mid + 1) * B, count) - 1;
+            COUNT_HEAD_STAT(compares);
+            if (slot.block[mid].head[last % B] < keyHead)
+                lowBlock = mid + 1;
+            else
+                highBlock = mid;
+        }
+        if (lowBlock == blocks)
+            return equalityOnly ? -1 : count;
+
+        COUNT_HEAD_STAT(compares);
+        unsigned lower = lowBlock * B + __builtin_popcount(maskBelow<false>(slot.block[lowBlock].head, keyHead) & validMask(lowBlock));
+        if (slot[lower].head != keyHead)
+            return equalityOnly ? -1 : lower;
+
+        // head tie, find the end of the equal heads and compare the remainders
+        unsigned upper;
+        for (unsigned b = lowBlock;; b++)
+        {
+            u32 valid = validMask(b);
+            u32 below = maskBelow<true>(slot.block[b].head, keyHead) & valid;
+            upper = b * B + __builtin_popcount(below);
+            if (below != valid || b + 1 == blocks)
+                break;
+        }
+        return lowerBoundHeadTie<equalityOnly>(lower, upper, key, keyLength, oldKeyLength);
+    }
+
     void updateHints(unsigned slot_id)
     {
+        if constexpr (Slots::contiguousHeads)
+            return;
         unsigned dist = count / (hintCount + 1);
         unsigned begin = 0;
         if ((count > hintCount * 2 + 1) && (((count - 1) / (hintCount + 1)) == dist) && ((slot_id / dist) > 1))
@@ -789,63 +1456,95 @@ struct BTreeNode : public BTreeNodeHeader
     }
     bool insert(u8 *key, unsigned keyLength, SwipType value, u8 *payload = nullptr)
     { 
-        if (!is_leaf && is_eyt)
-        {
-            convertFromEytzinger(slot, count, slot[count]);
-            assert(isSorted(slot, count));
-        }
-        const u16 space_needed = (is_leaf) ? u64(value) + spaceNeeded(keyLength, prefix_len) : spaceNeeded(keyLength, prefix_len);
+        assert(isSorted(slot, count));
+        const unsigned space_needed = (is_leaf) ? payloadSpace(u64(value)) + spaceNeeded(keyLength, prefix_len, Lengths::sizeOf(u64(value))) : spaceNeeded(keyLength, prefix_len);
         if (!allocateSpace(space_needed))
         {
-            if (!is_leaf && !is_eyt)
-                convertToEytzinger(slot, count);
             return false; // not enough space insert fails
         }
         unsigned slot_id = lowerBound<false>(key, keyLength);
-        memmove(slot + slot_id + 1, slot + slot_id, sizeof(PageSlot) * (count - slot_id)); // move the bigger fences one slot higher
+        Slots::moveUp(slot, slot_id, count); // move the bigger fences one slot higher
         storePayload(slot_id, key, keyLength, value, payload); // store the key value pair
         count++;
         updateHints(slot_id);
         assert(lowerBound<true>(key, keyLength) == slot_id); // duplicate check
-        if (!is_leaf && !is_eyt)
+        invalidateIndex();
+        return true;
+    }
+
+    /**
+     * @brief replaces the payload of leaf record slot_id, the key and slot stay. a payload of the
+     * same size is overwritten in place, a smaller one is rewritten at the old offset and leaves a
+     * hole, a larger one moves the record to the free space. returns false if that has no room,
+     * the caller removes and inserts the record then. a blob of the old value is released
+     */
+    bool updatePayload(unsigned slot_id, SwipType value, u8 *payload)
+    {
+        assert(is_leaf);
+        u64 oldField = getLengthField(slot_id);
+        u64 newField = u64(value);
+        u8 *record = ptr() + slot[slot_id].offset;
+        unsigned oldHeader = recordHeader(slot_id);
+        unsigned newHeader = Lengths::sizeOf(newField);
+        BlobPage *oldBlob = (oldField & blobFlag) ? getBlob(slot_id) : nullptr;
+        if (newHeader == oldHeader && payloadSpace(newField) == payloadSpace(oldField))
         {
-            convertToEytzinger(slot, count);
+            Lengths::store(record, newField);
+            memcpy(getValue(slot_id), payload, payloadSpace(newField));
         }
+        else
+        {
+            // the key rest with the u16 length of a large key, it moves unchanged
+            unsigned oldSpace = calculateSlotSpace(this, slot_id);
+            unsigned keySpace = oldSpace - oldHeader - payloadSpace(oldField);
+            unsigned newSpace = newHeader + keySpace + payloadSpace(newField);
+            unsigned offset;
+            if (newSpace <= oldSpace)
+                offset = slot[slot_id].offset;
+            else if (free_offset >= slotAreaEnd(count) + newSpace)
+                offset = free_offset -= newSpace;
+            else
+                return false;
+            memmove(ptr() + offset + newHeader, record + oldHeader, keySpace);
+            Lengths::store(ptr() + offset, newField);
+            memcpy(ptr() + offset + newHeader + keySpace, payload, payloadSpace(newField));
+            slot[slot_id].offset = offset;
+            space_used += newSpace - oldSpace;
+        }
+        if (oldBlob)
+            BlobPage::release(*Pages::of(this), oldBlob);
         return true;
     }
 
     bool removeSlot(unsigned slot_id)
     {
-        if (slot[slot_id].remainderLen)
-            space_used -= sizeof(SwipType) + (isLarge(slot_id) ? (getRestLenLarge(slot_id) + sizeof(u16)) : slot[slot_id].remainderLen);
-        space_used -= getPayloadLength(slot_id);
-        memmove(slot + slot_id, slot + slot_id + 1, sizeof(PageSlot) * (count - slot_id - 1));
+        space_used -= recordHeader(slot_id) + (isLarge(slot_id) ? (getRestLenLarge(slot_id) + sizeof(u16)) : slot[slot_id].remainderLen);
+        if (is_leaf)
+            space_used -= payloadSpace(getLengthField(slot_id));
+        Slots::moveDown(slot, slot_id, count);
         count--;
         makeHint();
+        invalidateIndex();
         return true;
     }
 
     bool remove(u8 *key, unsigned keyLength)
     {
-        if (!is_leaf && is_eyt)
-        {
-            convertFromEytzinger(slot, count, slot[count]);
-        }
         int slot_id = lowerBound<true>(key, keyLength);
         bool ret;
         if (slot_id == -1)
             ret = false;
         else
+        {
+            if (is_leaf && isBlob(slot_id))
+                BlobPage::release(*Pages::of(this), getBlob(slot_id));
             ret = removeSlot(slot_id);
+        }
         return ret;
     }
 
     bool remove(unsigned slot_id)
     {
-        if (!is_leaf && is_eyt)
-        {
-            convertFromEytzinger(slot, count, slot[count]);
-        }
         bool ret;
         if (slot_id == static_cast<unsigned>(-1))
             ret = false;
@@ -855,91 +1554,332 @@ struct BTreeNode : public BTreeNodeHeader
         return ret;
     }
 
+    // bytes two fences share, a missing fence shares none
+    static unsigned sharedPrefix(u8 *a, unsigned aLength, u8 *b, unsigned bLength)
+    {
+        unsigned n = 0;
+        if (a && b)
+            while (n < min(aLength, bLength) && a[n] == b[n])
+                n++;
+        return n;
+    }
+
+    /**
+     * @brief moves the records and fences to the end of the page, the holes of removed records
+     * become free space. a split leaves the prefix of the node that stays in place as it was,
+     * the keys lose the bytes the fences have in common since then here
+     */
     void compact()
     {
-        unsigned should = spacePostCompact();
-        static_cast<void>(should);
-        BTreeNode tmp(is_leaf);
-        tmp.setFences(getLowerFenceKey(), lower_fence.length, getUpperFenceKey(), upper_fence.length);
-        copyKeyValueRange(&tmp, 0, 0, count);
-        tmp.upper = upper;
-        memcpy(reinterpret_cast<char *>(this), &tmp, sizeof(BTreeNode));
-        makeHint();
+        rebuildHeap(sharedPrefix(getLowerFenceKey(), lower_fence.length, getUpperFenceKey(), upper_fence.length));
     }
 
-    unsigned calculateMergeSpace(const BTreeNode &tempNode, const BTreeNode *right, unsigned slot_id = 0, BTreeNode *parent = nullptr)
+    // heap bytes of a record in a node with the given prefix
+    unsigned recordSpace(unsigned slot_id, unsigned prefix)
     {
-        unsigned leftGrow = (prefix_len - tempNode.prefix_len) * count;
-        unsigned rightGrow = (right->prefix_len - tempNode.prefix_len) * right->count;
-        unsigned innerGrow = 0;
-        if (parent)
+        unsigned space = spaceNeeded(getFullKeyLength(slot_id), prefix, recordHeader(slot_id)) - Slots::slotBytes;
+        return is_leaf ? space + payloadSpace(getLengthField(slot_id)) : space;
+    }
+
+    unsigned heapSpace(unsigned prefix)
+    {
+        unsigned space = 0;
+        for (unsigned i = 0; i < count; i++)
+            space += recordSpace(i, prefix);
+        return space;
+    }
+
+    /**
+     * @brief writes record slot_id ending at offset end (atEnd) or starting at offset at, with
+     * its key for a node prefix that is strip bytes longer or extendLength bytes shorter. the key
+     * is buffered, so the record may overlap its old place. returns the bytes of the record
+     */
+    unsigned rewriteRecord(unsigned slot_id, unsigned at, bool atEnd, u8 *extend, unsigned extendLength, unsigned strip)
+    {
+        u8 *record = ptr() + slot[slot_id].offset;
+        unsigned header = recordHeader(slot_id);
+        bool large = isLarge(slot_id);
+        unsigned restLength = large ? getRestLenLarge(slot_id) : getRemainderLength(slot_id);
+        u8 *rest = large ? getRemainderLarge(slot_id) : getRest(slot_id);
+        unsigned payload = is_leaf ? payloadSpace(getLengthField(slot_id)) : 0;
+        if (!extendLength && !strip)
+        {
+            unsigned size = rest + restLength + payload - record;
+            unsigned offset = atEnd ? at - size : at;
+            memmove(ptr() + offset, record, size);
+            slot[slot_id].offset = offset;
+            return size;
+        }
+
+        // the key without the node prefix: extend, head and rest, minus the stripped bytes
+        unsigned headLength = slot[slot_id].headLen;
+        u8 full[extendLength + headLength + restLength];
+        if (extendLength)
+            memcpy(full, extend, extendLength);
+        Head head = swap(Head(slot[slot_id].head));
+        memcpy(full + extendLength, &head, headLength);
+        memcpy(full + extendLength + headLength, rest, restLength);
+        u8 *key = full + strip;
+        unsigned keyLength = sizeof(full) - strip;
+        u8 recordHeaderBytes[16];
+        assert(header <= sizeof(recordHeaderBytes));
+        memcpy(recordHeaderBytes, record, header);
+        u8 *payloadBytes = rest + restLength;
+
+        slot[slot_id].headLen = min<unsigned>(keyLength, sizeof(Head));
+        slot[slot_id].head = extractKeyHead(key, keyLength);
+        bool nowLarge = keyLength > limit;
+        unsigned size = header + (nowLarge ? sizeof(u16) : 0) + keyLength + payload;
+        unsigned offset = atEnd ? at - size : at;
+        // the payload is the only part read from the page, it goes first
+        memmove(ptr() + offset + size - payload, payloadBytes, payload);
+        memcpy(ptr() + offset, recordHeaderBytes, header);
+        slot[slot_id].offset = offset;
+        if (nowLarge)
+        {
+            setLarge(slot_id);
+            getRestLenLarge(slot_id) = keyLength;
+            memcpy(getRemainderLarge(slot_id), key, keyLength);
+        }
+        else
+        {
+            slot[slot_id].remainderLen = keyLength;
+            memcpy(getRest(slot_id), key, keyLength);
+        }
+        return size;
+    }
+
+    // sorts heap entries (offset << 16 | id) by descending offset, a counting pass per offset byte
+    static void sortByOffset(u32 *order, unsigned entries)
+    {
+        u32 scratch[entries];
+        u32 *from = order, *to = scratch;
+        for (unsigned shift = 16; shift < 32; shift += 8)
         {
-            unsigned extraKeyLength = parent->getFullKeyLength(slot_id);
-            innerGrow = spaceNeeded(extraKeyLength, tempNode.prefix_len);
+            unsigned start[257] = {};
+            for (unsigned e = 0; e < entries; e++)
+                start[256 - (from[e] >> shift & 0xff)]++;
+            for (unsigned b = 1; b < 257; b++)
+                start[b] += start[b - 1];
+            for (unsigned e = 0; e < entries; e++)
+                to[start[255 - (from[e] >> shift & 0xff)]++] = from[e];
+            std::swap(from, to);
         }
+    }
 
-        return space_used + right->space_used + (reinterpret_cast<u8 *>(slot + count + right->count) - ptr()) + leftGrow + rightGrow + innerGrow;
+    /**
+     * @brief rewrites the heap in place for the prefix newPrefix, without a temporary page.
+     * the records and fences are packed to the end of the page from the highest offset down,
+     * so every entry only moves up over space that was already read. a longer prefix drops
+     * bytes from the front of the keys on the way. a shorter prefix makes the keys grow,
+     * a second pass from the lowest offset up moves them down again with the lost prefix
+     * bytes of a fence in front. a fence the caller replaces is cleared before
+     */
+    void rebuildHeap(unsigned newPrefix)
+    {
+        unsigned strip = newPrefix > prefix_len ? newPrefix - prefix_len : 0;
+        unsigned extendLength = prefix_len > newPrefix ? prefix_len - newPrefix : 0;
+        // one spare byte, a zero length array is undefined
+        u8 extend[extendLength + 1];
+        // both fences start with the prefix
+        if (extendLength)
+            memcpy(extend, (lower_fence.offset ? getLowerFenceKey() : getUpperFenceKey()) + newPrefix, extendLength);
+
+        // heap entries by descending offset: slot ids, the fences as count and count + 1
+        const unsigned lowerId = count, upperId = count + 1;
+        u32 order[count + 2];
+        unsigned entries = 0;
+        for (unsigned i = 0; i < count; i++)
+            order[entries++] = u32(slot[i].offset) << 16 | i;
+        if (lower_fence.offset)
+            order[entries++] = u32(lower_fence.offset) << 16 | lowerId;
+        if (upper_fence.offset)
+            order[entries++] = u32(upper_fence.offset) << 16 | upperId;
+        // ascending inserts leave the heap in slot order already
+        if (!std::is_sorted(order, order + entries, std::greater<u32>()))
+            sortByOffset(order, entries);
+
+        auto moveFence = [&](unsigned id, unsigned at, bool atEnd) -> unsigned
+        {
+            FenceKey &fence = id == lowerId ? lower_fence : upper_fence;
+            unsigned offset = atEnd ? at - fence.length : at;
+            memmove(ptr() + offset, ptr() + fence.offset, fence.length);
+            fence.offset = offset;
+            return fence.length;
+        };
+        unsigned end = pageSize();
+        for (unsigned e = 0; e < entries; e++)
+        {
+            unsigned id = order[e] & 0xffff;
+            end -= id < count ? rewriteRecord(id, end, true, nullptr, 0, strip) : moveFence(id, end, true);
+        }
+        if (extendLength)
+        {
+            unsigned grown = 0;
+            for (unsigned i = 0; i < count; i++)
+                grown += recordSpace(i, newPrefix) - calculateSlotSpace(this, i);
+            assert(end - grown >= slotAreaEnd(count));
+            end -= grown;
+            unsigned at = end;
+            for (unsigned e = entries; e-- > 0;)
+            {
+                unsigned id = order[e] & 0xffff;
+                at += id < count ? rewriteRecord(id, at, false, extend, extendLength, 0) : moveFence(id, at, false);
+            }
+            assert(at == pageSize());
+        }
+        prefix_len = newPrefix;
+        free_offset = end;
+        space_used = pageSize() - end;
+        if (strip || extendLength)
+        {
+            makeHint();
+            invalidateIndex();
+        }
     }
 
-    void performLeafNodeMerge(BTreeNode *tempNode, BTreeNode *right, BTreeNode *parent, unsigned slot_id)
+    // drops the records [from, to), their heap space becomes a hole until the next compaction
+    void removeRange(unsigned from, unsigned to)
     {
-        copyKeyValueRange(tempNode, 0, 0, count);
-        right->copyKeyValueRange(tempNode, count, 0, right->count);
-        parent->remove(slot_id);
-        memcpy(reinterpret_cast<u8 *>(right), tempNode, sizeof(BTreeNode));
-        right->makeHint();
+        for (unsigned i = from; i < to; i++)
+            space_used -= calculateSlotSpace(this, i);
+        Slots::shift(slot, to, count, -int(to - from));
+        count -= to - from;
     }
 
-    bool mergeLeafNodes(unsigned slot_id, BTreeNode *parent, BTreeNode *right)
+    // removes the records [from, to) and releases their blobs
+    void removeSlots(unsigned from, unsigned to)
     {
-        assert(right->is_leaf);
-        BTreeNode tempNode(is_leaf);
-        tempNode.setFences(getLowerFenceKey(), lower_fence.length, right->getUpperFenceKey(), right->upper_fence.length);
+        if (is_leaf)
+            for (unsigned i = from; i < to; i++)
+                if (isBlob(i))
+                    BlobPage::release(*Pages::of(this), getBlob(i));
+        removeRange(from, to);
+        makeHint();
+        invalidateIndex();
+    }
 
-        // Calculate space requirement
-        unsigned spaceNeeded = calculateMergeSpace(tempNode, right);
-        if (spaceNeeded > PAGE_SIZE)
-            return false;
+    // the blobs of a leaf that is freed as a whole, its records are not removed
+    void releaseBlobs()
+    {
+        for (unsigned i = 0; i < count; i++)
+            if (isBlob(i))
+                BlobPage::release(*Pages::of(this), getBlob(i));
+    }
 
-        // Perform merging
-        performLeafNodeMerge(&tempNode, right, parent, slot_id);
-        return true;
+    // a hole at the bottom of the heap goes back to the free space without moving anything
+    void trimHeap()
+    {
+        unsigned bottom = pageSize();
+        for (unsigned i = 0; i < count; i++)
+            bottom = min<unsigned>(bottom, slot[i].offset);
+        if (lower_fence.offset)
+            bottom = min<unsigned>(bottom, lower_fence.offset);
+        if (upper_fence.offset)
+            bottom = min<unsigned>(bottom, upper_fence.offset);
+        free_offset = bottom;
     }
 
-    void performInnerNodeMerge(BTreeNode *tempNode, BTreeNode *right, BTreeNode *parent, unsigned slot_id)
+    /**
+     * @brief replaces the lower or upper fence in place and leaves room for slots more records
+     * with heap bytes. a longer shared prefix of the fences is left to the next compaction,
+     * the records are only rewritten if the prefix shrinks or the heap is too full
+     */
+    void setFence(FenceKey &fence, u8 *key, unsigned keyLength, unsigned slots = 0, unsigned heap = 0)
     {
-        copyKeyValueRange(tempNode, 0, 0, count);
-        unsigned extraKeyLength = parent->getFullKeyLength(slot_id);
-        u8 extraKey[extraKeyLength];
-        parent->copyKeyOut(slot_id, extraKey, extraKeyLength);
-        storePayload(count, extraKey, extraKeyLength, parent->getChild(slot_id));
-        count++;
-        right->copyKeyValueRange(tempNode, count, 0, right->count);
-        parent->removeSlot(slot_id);
-        memcpy(reinterpret_cast<u8 *>(right), tempNode, sizeof(BTreeNode));
+        bool lower = &fence == &lower_fence;
+        unsigned newPrefix = lower ? sharedPrefix(key, keyLength, getUpperFenceKey(), upper_fence.length)
+                                   : sharedPrefix(getLowerFenceKey(), lower_fence.length, key, keyLength);
+        space_used -= fence.length;
+        fence = {0, 0};
+        trimHeap();
+        if (newPrefix < prefix_len || free_offset < slotAreaEnd(count + slots) + keyLength + heap)
+            rebuildHeap(newPrefix);
+        assert(free_offset >= slotAreaEnd(count + slots) + keyLength + heap);
+        insertFence(fence, key, keyLength);
     }
 
-    bool mergeInnerNodes(unsigned slot_id, BTreeNode *parent, BTreeNode *right)
+    // prefix of right after it took the records of this node, as setFence leaves it
+    unsigned mergedPrefix(BTreeNode *right)
     {
-        assert(!right->is_leaf);
-        BTreeNode tempNode(is_leaf);
-        tempNode.setFences(getLowerFenceKey(), lower_fence.length, right->getUpperFenceKey(), right->upper_fence.length);
+        return min<unsigned>(right->prefix_len, sharedPrefix(getLowerFenceKey(), lower_fence.length, right->getUpperFenceKey(), right->upper_fence.length));
+    }
+
+    // bytes of the page that merges this node into right: slot area, fences and the records with the merged prefix
+    unsigned calculateMergeSpace(unsigned newPrefix, BTreeNode *right, unsigned slot_id = 0, BTreeNode *parent = nullptr)
+    {
+        unsigned slots = count + right->count;
+        unsigned heap = lower_fence.length + right->upper_fence.length + heapSpace(newPrefix) + right->heapSpace(newPrefix);
+        // an inner merge pulls the separator of the parent down between the two halves
+        if (parent)
+        {
+            heap += spaceNeeded(parent->getFullKeyLength(slot_id), newPrefix) - Slots::slotBytes;
+            slots++;
+        }
+        return slotAreaEnd(slots) + heap;
+    }
 
-        // Calculate space requirement
-        unsigned spaceNeeded = calculateMergeSpace(tempNode, right, slot_id, parent);
+    // adds the page of this node to the memory usage of its level
+    void accountMemory(LevelMemory &level)
+    {
+        level.pages++;
+        level.bytes += pageSize();
+        level.liveBytes += space_used;
+        level.freeBytes += free_offset - slotAreaEnd(count);
+        level.fragmentedBytes += pageSize() - free_offset - space_used;
+    }
 
-        if (spaceNeeded > PAGE_SIZE)
+    // right takes the records of this node in front of its own, in place
+    bool mergeLeafNodes(unsigned slot_id, BTreeNode *parent, BTreeNode *right)
+    {
+        assert(right->is_leaf);
+        unsigned newPrefix = mergedPrefix(right);
+        if (calculateMergeSpace(newPrefix, right) > pageSize())
             return false;
+        right->setFence(right->lower_fence, getLowerFenceKey(), lower_fence.length, count, heapSpace(newPrefix));
+        Slots::shift(right->slot, 0, right->count, count);
+        copyKeyValueRange(right, 0, 0, count);
+        parent->remove(slot_id);
+        right->makeHint();
+        right->invalidateIndex();
+        return true;
+    }
 
-        // Perform merging
-        performInnerNodeMerge(&tempNode, right, parent, slot_id);
+    // the separator of the parent becomes the record of the upper child of this node
+    bool mergeInnerNodes(unsigned slot_id, BTreeNode *parent, BTreeNode *right)
+    {
+        assert(!right->is_leaf);
+        unsigned newPrefix = mergedPrefix(right);
+        if (calculateMergeSpace(newPrefix, right, slot_id, parent) > pageSize())
+            return false;
+        unsigned extraKeyLength = parent->getFullKeyLength(slot_id);
+        u8 extraKey[extraKeyLength];
+        parent->copyKeyOut(slot_id, extraKey, extraKeyLength);
+        unsigned heap = heapSpace(newPrefix) + spaceNeeded(extraKeyLength, newPrefix) - Slots::slotBytes;
+        right->setFence(right->lower_fence, getLowerFenceKey(), lower_fence.length, count + 1, heap);
+        Slots::shift(right->slot, 0, right->count, count + 1);
+        copyKeyValueRange(right, 0, 0, count);
+        right->storePayload(count, extraKey, extraKeyLength, upper);
+        if constexpr (countRecords)
+            right->entryRecords(count) = this->upperRecords;
+        right->count++;
+        parent->removeSlot(slot_id);
+        right->makeHint();
+        right->invalidateIndex();
         return true;
     }
 
-    // merge is not really necesarry and this does not work 100% of the time
+    /**
+     * @brief merges this node into its right sibling, slot_id is the parent record of this node.
+     * the right sibling is the child of the next record or the upper of the parent. the
+     * caller releases this node if the merge succeeds
+     */
     bool merge(unsigned slot_id, BTreeNode *parent, BTreeNode *right)
     {
-        
+        // the records of this node are counted for the right sibling once they moved there
+        u64 moved = 0;
+        if constexpr (countRecords)
+            moved = parent->childRecords(slot_id);
         bool ret;
         if (is_leaf)
         {
@@ -949,17 +1889,28 @@ struct BTreeNode : public BTreeNodeHeader
         {
             ret = mergeInnerNodes(slot_id, parent, right);
         }
+        if constexpr (countRecords)
+            if (ret)
+                parent->childRecords(slot_id) += moved;
         return ret;
     }
 
     bool allocateSpaceForKeyValue(unsigned slot_id, unsigned keyLength, SwipType value, bool isLeaf)
     {
-        unsigned spaceNeeded = keyLength + sizeof(SwipType) + ((keyLength > limit) ? sizeof(u16) : 0) + (isLeaf ? u64(value) : 0);
+        unsigned header = isLeaf ? Lengths::sizeOf(u64(value)) : innerHeader;
+        unsigned spaceNeeded = keyLength + header + ((keyLength > limit) ? sizeof(u16) : 0) + (isLeaf ? payloadSpace(u64(value)) : 0);
         free_offset -= spaceNeeded;
         space_used += spaceNeeded;
         slot[slot_id].offset = free_offset;
-        getChild(slot_id) = value;
-        return spaceNeeded <= PAGE_SIZE;
+        if (isLeaf)
+            Lengths::store(ptr() + free_offset, u64(value));
+        else
+        {
+            getChild(slot_id) = value;
+            if constexpr (countRecords)
+                entryRecords(slot_id) = 0;
+        }
+        return spaceNeeded <= pageSize();
     }
 
     void storeLargeKeyValue(unsigned slot_id, u8 *key, unsigned keyLength, u8 *payload)
@@ -970,7 +1921,7 @@ struct BTreeNode : public BTreeNodeHeader
         if (is_leaf)
         {
             assert(payload != nullptr);
-            memcpy(getPayloadLarge(slot_id), payload, getPayloadLength(slot_id));
+            memcpy(getPayloadLarge(slot_id), payload, payloadSpace(getLengthField(slot_id)));
         }
     }
 
@@ -981,7 +1932,7 @@ struct BTreeNode : public BTreeNodeHeader
         if (is_leaf)
         {
             assert(payload != nullptr);
-            memcpy(getPayload(slot_id), payload, getPayloadLength(slot_id));
+            memcpy(getPayload(slot_id), payload, payloadSpace(getLengthField(slot_id)));
         }
     }
 
@@ -991,7 +1942,7 @@ struct BTreeNode : public BTreeNodeHeader
         key += prefix_len;
         keyLength -= prefix_len;
 
-        slot[slot_id].headLen = (keyLength >= sizeof(u32)) ? sizeof(u32) : keyLength;
+        slot[slot_id].headLen = (keyLength >= sizeof(Head)) ? sizeof(Head) : keyLength;
         slot[slot_id].head = extractKeyHead(key, keyLength);
 
         if (!allocateSpaceForKeyValue(slot_id, keyLength, value, is_leaf))
@@ -1012,9 +1963,9 @@ struct BTreeNode : public BTreeNodeHeader
     unsigned
     calculateSlotSpace(BTreeNode *node, unsigned slotIndex)
     {
-        unsigned space = sizeof(SwipType) + (node->isLarge(slotIndex) ? (node->getRestLenLarge(slotIndex) + sizeof(u16)) : node->getRemainderLength(slotIndex));
+        unsigned space = node->recordHeader(slotIndex) + (node->isLarge(slotIndex) ? (node->getRestLenLarge(slotIndex) + sizeof(u16)) : node->getRemainderLength(slotIndex));
         if (node->is_leaf)
-            space += node->getPayloadLength(slotIndex);
+            space += payloadSpace(node->getLengthField(slotIndex));
         return space;
     }
 
@@ -1032,11 +1983,9 @@ struct BTreeNode : public BTreeNodeHeader
 
     void copyKeyValueRange(BTreeNode *dst, unsigned dstSlot, unsigned srcSlot, unsigned count)
     {
-        if (!is_leaf && is_eyt)
-            throw std::invalid_argument("CopyValueRange fails");
         if (prefix_len == dst->prefix_len)
         {
-            memcpy(dst->slot + dstSlot, slot + srcSlot, sizeof(PageSlot) * count);
+            Slots::copy(dst->slot, dstSlot, slot, srcSlot, count);
             for (unsigned i = 0; i < count; i++)
             {
                 copySlotData(dst, this, dstSlot + i, srcSlot + i);
@@ -1050,7 +1999,7 @@ struct BTreeNode : public BTreeNodeHeader
             }
         }
         dst->count += count;
-        assert((ptr() + dst->free_offset) >= reinterpret_cast<u8 *>(slot + count));
+        assert(dst->free_offset >= slotAreaEnd(dst->count));
     }
 
     void copyKeyValue(u16 srcSlot, BTreeNode *dst, u16 dstSlot)
@@ -1058,7 +2007,11 @@ struct BTreeNode : public BTreeNodeHeader
         unsigned fullLength = getFullKeyLength(srcSlot);
         u8 key[fullLength];
         copyKeyOut(srcSlot, key, fullLength);
-        dst->storePayload(dstSlot, key, fullLength, getChild(srcSlot), (isLarge(srcSlot) ? getPayloadLarge(srcSlot) : getPayload(srcSlot)));
+        SwipType value = is_leaf ? SwipType(getLengthField(srcSlot)) : SwipType(getChild(srcSlot));
+        dst->storePayload(dstSlot, key, fullLength, value, (isLarge(srcSlot) ? getPayloadLarge(srcSlot) : getPayload(srcSlot)));
+        if constexpr (countRecords)
+            if (!is_leaf)
+                dst->entryRecords(dstSlot) = entryRecords(srcSlot);
     }
     void insertFence(FenceKey &fk, u8 *key, unsigned keyLength)
     {
@@ -1080,50 +2033,276 @@ struct BTreeNode : public BTreeNodeHeader
             ;
     }
 
+    // fences of an empty node from the lower fence of lowerNode to the upper fence of upperNode
+    void setFencesOf(BTreeNode *lowerNode, BTreeNode *upperNode)
+    {
+        setFences(lowerNode->getLowerFenceKey(), lowerNode->lower_fence.length, upperNode->getUpperFenceKey(), upperNode->upper_fence.length);
+    }
+
     BTreeNode *createNewNode(bool isLeaf, u8 *lowerKey, unsigned lowerLength, u8 *upperKey, unsigned upperLength)
     {
-        BTreeNode *newNode = new BTreeNode(isLeaf);
+        BTreeNode *newNode = allocate(*Pages::of(this), isLeaf);
         newNode->setFences(lowerKey, lowerLength, upperKey, upperLength);
         return newNode;
     }
-    void performCopyAndUpdate(BTreeNode *leftNode, BTreeNode *rightNode, unsigned sepSlot, bool isLeaf)
+    /**
+     * @brief splits after sepSlot, at an inner split the child of sepSlot becomes the upper of
+     * the left half. only one half is copied to a new node, the other stays in place and gets
+     * the separator as its new fence. the half that stays is the one higher in the heap: the
+     * records of the other half were written last and their space at the bottom of the heap
+     * is free again without moving anything, e.g. the upper half for ascending inserts
+     */
+    void split(BTreeNode *parent, unsigned sepSlot, u8 *sepKey, unsigned sepLength)
     {
-        if (isLeaf)
-        {
-            copyKeyValueRange(leftNode, 0, 0, sepSlot + 1);
-
-            copyKeyValueRange(rightNode, 0, leftNode->count, count - (sepSlot + 1));
-
+        assert(sepSlot < slotnum);
+        unsigned lowerBottom = pageSize(), upperBottom = pageSize();
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned &bottom = i <= sepSlot ? lowerBottom : upperBottom;
+            bottom = min<unsigned>(bottom, slot[i].offset);
+        }
+        bool keepLeft = upperBottom < lowerBottom;
+
+        BTreeNode *moved;
+        if (keepLeft)
+        {
+            moved = createNewNode(is_leaf, sepKey, sepLength, getUpperFenceKey(), upper_fence.length);
+            bool success = parent->insert(sepKey, sepLength, this);
+            assert(success);
+            static_cast<void>(success); //for -DNDEBUG -WUnused
+            // the parent record after the separator referred to this node before the split
+            unsigned pos = parent->template lowerBound<true>(sepKey, sepLength) + 1;
+            ChildRef &next = pos < parent->count ? parent->getChild(pos) : parent->upper;
+            assert(next == this);
+            next = moved;
+            copyKeyValueRange(moved, 0, sepSlot + 1, count - sepSlot - 1);
+            if (!is_leaf)
+            {
+                moved->upper = upper;
+                upper = getChild(sepSlot);
+                if constexpr (countRecords)
+                {
+                    moved->upperRecords = this->upperRecords;
+                    this->upperRecords = entryRecords(sepSlot);
+                }
+            }
+            removeRange(is_leaf ? sepSlot + 1 : sepSlot, count);
+            setFence(upper_fence, sepKey, sepLength);
         }
         else
         {
-            copyKeyValueRange(leftNode, 0, 0, sepSlot);
-            copyKeyValueRange(rightNode, 0, leftNode->count + 1, count - leftNode->count - 1);
-            leftNode->upper = getChild(leftNode->count);
-            rightNode->upper = upper;
+            moved = createNewNode(is_leaf, getLowerFenceKey(), lower_fence.length, sepKey, sepLength);
+            bool success = parent->insert(sepKey, sepLength, moved);
+            assert(success);
+            static_cast<void>(success); //for -DNDEBUG -WUnused
+            if (is_leaf)
+                copyKeyValueRange(moved, 0, 0, sepSlot + 1);
+            else
+            {
+                copyKeyValueRange(moved, 0, 0, sepSlot);
+                moved->upper = getChild(sepSlot);
+                if constexpr (countRecords)
+                    moved->upperRecords = entryRecords(sepSlot);
+            }
+            removeRange(0, sepSlot + 1);
+            setFence(lower_fence, sepKey, sepLength);
+        }
+        if constexpr (countRecords)
+        {
+            // the separator refers to the lower half, the record after it to the upper half
+            unsigned pos = parent->template lowerBound<true>(sepKey, sepLength);
+            parent->childRecords(pos) = (keepLeft ? this : moved)->records();
+            parent->childRecords(pos + 1) = (keepLeft ? moved : this)->records();
         }
-        leftNode->makeHint();
-        rightNode->makeHint();
+        moved->makeHint();
+        makeHint();
+        invalidateIndex();
     }
 
-    void split(BTreeNode *parent, unsigned sepSlot, u8 *sepKey, unsigned sepLength)
+    // leaf separators of a bulk load may be cut like those of separatorAt
+    static constexpr bool truncatedSeparators = true;
+    // slot and heap bytes of a record in a node with the given prefix, bulk loads pack nodes with it
+    static unsigned bulkRecordSpace(bool isLeaf, unsigned keyLength, u64 lengthField, unsigned prefix)
+    {
+        if (!isLeaf)
+            return spaceNeeded(keyLength, prefix);
+        return spaceNeeded(keyLength, prefix, Lengths::sizeOf(lengthField)) + payloadSpace(lengthField);
+    }
+    // bytes of a node with the fences and records slots besides the bulkRecordSpace of the records
+    static unsigned bulkNodeSpace(bool, unsigned records, unsigned lowerLength, unsigned upperLength)
+    {
+        return slotAreaEnd(records) - records * Slots::slotBytes + lowerLength + upperLength;
+    }
+    // appends a record above all others, the fences are set and the bulk load checked the space
+    void append(u8 *key, unsigned keyLength, SwipType value, u8 *payload)
+    {
+        storePayload(count, key, keyLength, value, payload);
+        count++;
+    }
+    // a bulk loaded node is written once, inner nodes get their search index right away
+    void finishBulk()
     {
-        assert(sepSlot < (BTreeNodeHeader::PAGE_SIZE / sizeof(SwipType)));
-        if (!is_leaf && is_eyt)
-            convertFromEytzinger(slot, count, slot[count]);
+        makeHint();
+        if constexpr (InnerLayout::indexed)
+            if (!is_leaf)
+                updateIndex<InnerLayout>();
+    }
 
-        BTreeNode *nodeLeft = createNewNode(is_leaf, getLowerFenceKey(), lower_fence.length, sepKey, sepLength);
-        BTreeNode tmp(is_leaf);
-        BTreeNode *nodeRight = &tmp;
-        nodeRight->setFences(sepKey, sepLength, getUpperFenceKey(), upper_fence.length);
+    /**
+     * @brief rebuilds the leaves below this inner node with about targetFill of their page
+     * used, on consecutive fresh pages in key order, and gives this node their separators.
+     * returns false and changes nothing if the separators or the records do not fit
+     */
+    bool repackLeaves(double targetFill)
+    {
+        struct Position
+        {
+            unsigned child, slot;
+        };
+        // an inner page has at most one child per slot it can hold, plus upper
+        constexpr size_t maxChildren = Slots::capacity(innerPageSize - slotOffset) + 1;
+        unsigned children = count + 1;
+        assert(children <= maxChildren);
+        BTreeNode *old[maxChildren];
+        for (unsigned i = 0; i < count; i++)
+            old[i] = getChild(i);
+        old[count] = upper;
+
+        auto commonPrefix = [](const u8 *a, unsigned aLength, const u8 *b, unsigned bLength)
+        {
+            unsigned n = 0;
+            while (n < min(aLength, bLength) && a[n] == b[n])
+                n++;
+            return n;
+        };
+        // heap and slot bytes of a record in a leaf with the given prefix
+        auto recordSize = [&](Position p, unsigned prefix)
+        {
+            BTreeNode *leaf = old[p.child];
+            return spaceNeeded(leaf->getFullKeyLength(p.slot), prefix, leaf->recordHeader(p.slot)) +
+                   payloadSpace(leaf->getLengthField(p.slot));
+        };
+        std::vector<u8> lowest(old[0]->getLowerFenceKey(), old[0]->getLowerFenceKey() + old[0]->lower_fence.length);
+        std::vector<u8> highest(old[count]->getUpperFenceKey(), old[count]->getUpperFenceKey() + old[count]->upper_fence.length);
+
+        // first record of every new leaf and the separators between them, shortest as in separatorAt.
+        // the prefix of a new leaf is the common prefix of its lower fence and its keys so far
+        unsigned budget = min(1.0, targetFill) * leafPageSize;
+        std::vector<Position> starts;
+        std::vector<std::vector<u8>> seps;
+        std::vector<u8> lower = lowest;
+        // the key of a record and of the one before it, the two buffers swap per record
+        std::vector<u8> keyBuffer(leafPageSize), prevBuffer(leafPageSize);
+        u8 *key = keyBuffer.data(), *prevKey = prevBuffer.data();
+        unsigned prevLength = 0;
+        unsigned prefix = lower.size(), records = 0, used = 0;
+        for (unsigned i = 0; i < children; i++)
+        {
+            for (unsigned s = 0; s < old[i]->count; s++)
+            {
+                unsigned keyLength = old[i]->getFullKeyLength(s);
+                old[i]->copyKeyOut(s, key, keyLength);
+                unsigned keyPrefix = min(prefix, commonPrefix(lower.data(), lower.size(), key, keyLength));
+                // the records so far lose the prefix bytes the new key does not share
+                unsigned grown = used + records * (prefix - keyPrefix);
+                unsigned size = recordSize({i, s}, keyPrefix);
+                if (records > 0 && slotOffset + lower.size() + keyLength + grown + size > budget)
+                {
+                    unsigned cut = commonPrefix(prevKey, prevLength, key, keyLength) + 1;
+                    if (cut < prevLength && cut < keyLength)
+                        seps.emplace_back(key, key + cut);
+                    else
+                        seps.emplace_back(prevKey, prevKey + prevLength);
+                    starts.push_back({i, s});
+                    lower.assign(seps.back().begin(), seps.back().end());
+                    keyPrefix = commonPrefix(lower.data(), lower.size(), key, keyLength);
+                    records = 0;
+                    grown = 0;
+                    size = recordSize({i, s}, keyPrefix);
+                }
+                if (starts.empty())
+                    starts.push_back({i, s});
+                used = grown + size;
+                prefix = keyPrefix;
+                records++;
+                std::swap(key, prevKey);
+                prevLength = keyLength;
+            }
+        }
+        if (starts.empty())
+            starts.push_back({count, 0});
+        starts.push_back({children, 0});
+        unsigned leaves = starts.size() - 1;
 
-        bool success = parent->insert(sepKey, sepLength, nodeLeft);
+        // the exact space of every new leaf with its final fences, before any page changes
+        auto lowerOf = [&](unsigned j) -> std::vector<u8> & { return j ? seps[j - 1] : lowest; };
+        auto upperOf = [&](unsigned j) -> std::vector<u8> & { return j + 1 < leaves ? seps[j] : highest; };
+        auto forEachRecord = [&](unsigned j, auto fn)
+        {
+            for (Position p = starts[j]; p.child < starts[j + 1].child || (p.child == starts[j + 1].child && p.slot < starts[j + 1].slot);)
+            {
+                unsigned end = p.child == starts[j + 1].child ? starts[j + 1].slot : old[p.child]->count;
+                if (end > p.slot)
+                    fn(p, end - p.slot);
+                p = {p.child + 1, 0};
+            }
+        };
+        for (unsigned j = 0; j < leaves; j++)
+        {
+            std::vector<u8> &lo = lowerOf(j), &hi = upperOf(j);
+            unsigned leafPrefix = (lo.empty() || hi.empty()) ? 0 : commonPrefix(lo.data(), lo.size(), hi.data(), hi.size());
+            unsigned n = 0, heap = lo.size() + hi.size();
+            forEachRecord(j, [&](Position p, unsigned length)
+                          {
+                              n += length;
+                              for (unsigned s = p.slot; s < p.slot + length; s++)
+                                  heap += recordSize({p.child, s}, leafPrefix) - Slots::slotBytes; });
+            if (slotAreaEnd(n) + heap > leafPageSize)
+                return false;
+        }
 
-        assert(success);
-        static_cast<void>(success); //for -DNDEBUG -WUnused
-        performCopyAndUpdate(nodeLeft, nodeRight, sepSlot, is_leaf);
+        // the separators have to fit this node with its fences, the prefix is the one the fences share
+        std::vector<u8> lowerFence(getLowerFenceKey(), getLowerFenceKey() + lower_fence.length);
+        std::vector<u8> upperFence(getUpperFenceKey(), getUpperFenceKey() + upper_fence.length);
+        unsigned innerPrefix = (lowerFence.empty() || upperFence.empty()) ? 0 : commonPrefix(lowerFence.data(), lowerFence.size(), upperFence.data(), upperFence.size());
+        unsigned innerHeap = lowerFence.size() + upperFence.size();
+        for (unsigned j = 0; j + 1 < leaves; j++)
+            innerHeap += spaceNeeded(seps[j].size(), innerPrefix) - Slots::slotBytes;
+        if (slotAreaEnd(leaves - 1) + innerHeap > innerPageSize)
+            return false;
 
-        memcpy(reinterpret_cast<char *>(this), nodeRight, sizeof(BTreeNode));
+        // this node is emptied in place down to its fences and takes the separators
+        count = 0;
+        space_used = 0;
+        free_offset = innerPageSize;
+        lower_fence = upper_fence = {0, 0};
+        setFences(lowerFence.empty() ? nullptr : lowerFence.data(), lowerFence.size(), upperFence.empty() ? nullptr : upperFence.data(), upperFence.size());
+        for (unsigned j = 0; j + 1 < leaves; j++)
+        {
+            storePayload(j, seps[j].data(), seps[j].size(), nullptr);
+            count++;
+        }
+        Pages &pages = *Pages::of(this);
+        for (unsigned j = 0; j < leaves; j++)
+        {
+            BTreeNode *leaf = new (pages.allocateFresh(leafPageSize)) BTreeNode(true);
+            std::vector<u8> &lo = lowerOf(j), &hi = upperOf(j);
+            leaf->setFences(lo.empty() ? nullptr : lo.data(), lo.size(), hi.empty() ? nullptr : hi.data(), hi.size());
+            forEachRecord(j, [&](Position p, unsigned length)
+                          { old[p.child]->copyKeyValueRange(leaf, leaf->count, p.slot, length); });
+            leaf->makeHint();
+            if (j + 1 < leaves)
+                getChild(j) = leaf;
+            else
+                upper = leaf;
+            if constexpr (countRecords)
+                childRecords(j) = leaf->count;
+        }
+        makeHint();
+        invalidateIndex();
+        for (unsigned i = 0; i < children; i++)
+            release(old[i]);
+        return true;
     }
 
     struct SeparatorInfo
@@ -1170,53 +2349,67 @@ struct BTreeNode : public BTreeNodeHeader
         unsigned limit = min(slot[posA].headLen, slot[posB].headLen);
         unsigned i;
         for (i = 0; i < limit; i++)
-            if (slot[posA].headBytes[3 - i] != slot[posB].headBytes[3 - i])
+            if (headByte(Head(slot[posA].head), sizeof(Head) - 1 - i) != headByte(Head(slot[posB].head), sizeof(Head) - 1 - i))
                 return i;
         return i;
     }
 
-    SeparatorInfo findSep()
+    /**
+     * @brief shortest separator of a split at slot s: an inner split has to push
+     * up key s, a leaf split may use any key in [key s, key s + 1). that is key s
+     * itself or key s + 1 cut after the first byte that differs from key s, if
+     * key s + 1 is longer than that
+     */
+    SeparatorInfo separatorAt(unsigned s)
     {
+        unsigned length = getFullKeyLength(s);
         if (isInner())
-            return SeparatorInfo{getFullKeyLength(count / 2), static_cast<unsigned>(count / 2), false};
+            return SeparatorInfo{length, s, false};
+        unsigned cut = prefix_len + commonPrefix(s, s + 1) + 1;
+        if (cut < length && cut < getFullKeyLength(s + 1))
+            return SeparatorInfo{cut, s, true};
+        return SeparatorInfo{length, s, false};
+    }
 
-        unsigned lower = count / 2 - count / 16;
-        unsigned upper = count / 2 + count / 16;
-        assert(upper < count);
-        unsigned maxPos = count / 2;
-        int maxPrefix = commonPrefix(maxPos, 0);
-        for (unsigned i = lower; i < upper; i++)
-        {
-            int prefix = commonPrefix(i, 0);
-            if (prefix > maxPrefix)
+    /**
+     * @brief picks the split slot in a window of count / 8 slots around the
+     * middle whose separator is the shortest, the slot closest to the middle
+     * wins ties. short separators raise the fanout of the parent, the window
+     * bounds the imbalance of the two halves
+     */
+    SeparatorInfo findSep()
+    {
+        unsigned middle = count / 2;
+        // a leaf split needs the key after the split slot
+        unsigned last = isInner() ? count - 1 : count - 2;
+        if (count < 4)
+            return separatorAt(min(middle, last));
+        int lower = middle - count / 16;
+        int upper = min(middle + count / 16, last);
+        SeparatorInfo best = separatorAt(middle);
+        for (int dist = 1; dist <= count / 16; dist++)
+        {
+            for (int s : {int(middle) - dist, int(middle) + dist})
             {
-                maxPrefix = prefix;
-                maxPos = i;
+                if (s < lower || s > upper)
+                    continue;
+                SeparatorInfo sep = separatorAt(s);
+                if (sep.length < best.length)
+                    best = sep;
             }
         }
-        unsigned common = commonPrefix(maxPos, maxPos + 1);
-        if ((common > sizeof(u32)) && (getFullKeyLength(maxPos) - prefix_len > common) && (getFullKeyLength(maxPos + 1) - prefix_len > common + 2))
-        {
-            return SeparatorInfo{static_cast<unsigned>(prefix_len + common + 1), maxPos, true};
-        }
-        return SeparatorInfo{getFullKeyLength(maxPos), maxPos, false};
+        return best;
     }
 
     void getSep(u8 *sepKeyOut, SeparatorInfo info)
     {
-        copyKeyOut(info.slot, sepKeyOut, info.length);
-        if (info.trunc)
-        {
-            u8 *k = isLarge(info.slot + 1) ? getRemainderLarge(info.slot + 1) : getRest(info.slot + 1);
-            sepKeyOut[info.length - 1] = k[info.length - prefix_len - sizeof(u32) - 1];
-        }
+        // a truncated separator is a prefix of the next key
+        copyKeyOut(info.trunc ? info.slot + 1 : info.slot, sepKeyOut, info.length);
     }
 
     BTreeNode *lookupInner(u8 *key, unsigned keyLength)
     {
-        if (!is_leaf && !is_eyt)
-            convertToEytzinger(slot, count);
-        unsigned pos2 = lowerBoundEytzinger<false>(key, keyLength);
+        unsigned pos2 = lookupInnerPos(key, keyLength);
         BTreeNode *y;
         if (pos2 >= count)
             y = upper;
@@ -1227,12 +2420,7 @@ struct BTreeNode : public BTreeNodeHeader
 
     unsigned lookupInnerPos(u8 *key, unsigned keyLength)
     {
-        if (!is_leaf && !is_eyt)
-        {
-            convertToEytzinger(slot, count);
-        }
-        unsigned pos = lowerBoundEytzinger<false>(key, keyLength);
-
+        unsigned pos = search<false>(key, keyLength);
         if (pos >= count)
         {
             pos = count;
@@ -1252,24 +2440,6 @@ struct BTreeNode : public BTreeNodeHeader
         }
         return output;
     }
-    /**
-     * @brief deletes every node in order
-     * @todo solve double free problem
-     */
-    void destroy()
-    {
-        if (isInner())
-        {
-            for (unsigned i = 0; i < count; i++)
-                getChild(i)->destroy();
-            upper->destroy();
-        }
-        delete this;
-        return;
-    }
-
-    
-
     void print()
     {
         return;
@@ -1296,101 +2466,6 @@ struct BTreeNode : public BTreeNodeHeader
         }
     }
 
-    void print(uint8_t *key, unsigned keyLength, uint8_t *keyOut,
-               const std::function<bool(unsigned int, uint8_t *, unsigned int)>
-                   &found_callback)
-    {
-        auto root = this;
-        auto node = this;
-        auto parent = this;
-
-        auto index = 0;
-        while (node->isInner())
-        {
-            root = parent;
-            parent = node;
-
-            node = node->lookupInner(key, keyLength);
-        }
-        index = parent->lookupInnerPos(key, keyLength);
-        parent->getChild(index)->print();
-        parent->print2(index, key, keyLength, keyOut, found_callback);
-        static_cast<void>(root);
-
-        // auto index2 = root->lookupInnerPos(key, keyLength);
-        // // root->getChild(index2)->print();
-        // // parent->print();
-        // // root->upper->getChild(25)->print();
-        // // root->getChild(25)->print();
-        // bool one_time = true;
-        // while (root != nullptr)
-        // {
-        //     EytzingerIterator it(root->count);
-        //     int x = -1;
-        //     while (x != index2 && it.hasNext())
-        //     {
-        //         x = it.next();
-        //     }
-        //     bool continueloop = true;
-        //     size_t i = it.hasNext() ? (one_time ? it.next() : x) : root->count;
-
-        //     for (; i < root->count && continueloop && cont; i = it.next())
-        //     {
-
-        //         // root->getChild(i)->getChild(findSmallestChildEyt(root->getChild(i)->count))->print();
-        //         // cout << "4++++++++++++++++++++++++++++++++++++++++++" << endl;
-        //         // cout << "THJIS IS A LEAF??????????" << getChild(i)->is_eyt << " and is leaf? : " << root->getChild(i)->is_leaf << endl;
-        //         // cout << "findSmallestChildEyt(getChild(i)->count)" << findSmallestChildEyt(root->count) << " and count " << root->count << endl;
-
-        //         if (!root->getChild(i)->is_eyt)
-        //         {
-
-        //             root->getChild(i)->print2(0, key, keyLength, keyOut, found_callback);
-        //         }
-        //         else
-        //         {
-
-        //             root->getChild(i)->print2(findSmallestChildEyt(root->getChild(i)->count), key, keyLength, keyOut, found_callback);
-        //         }
-        //         if (!it.hasNext())
-        //             break;
-        //     }
-        //     root = root->upper;
-        //     if (root == nullptr)
-        //         break;
-        //     int asd = root->count;
-        //     index2 = root->lookupInnerPos(key, keyLength);
-        //     // root->getChild(index2)->print();
-        //     one_time = false;
-        // }
-        // if (cont && tmp && parent->upper != nullptr)
-        // {
-        //     cout << "we are here" << endl;
-        //     cout << "root hasLP: " << root->count << ", and this count: " << index << endl;
-        //     cout << "++++++++++++++++++++++++++++++++++++++++++" << endl;
-
-        //     parent->upper->print();
-
-        //     cout << "++++++++++++++++++++++++++++++++++++++++++" << endl;
-
-        //     root->print();
-        //     cout << "++++++++++++++++++++++++++++++++++++++++++" << endl;
-
-        //     parent->upper->print2(findSmallestChildEyt(upper->count), key, keyLength, keyOut, found_callback);
-        // }
-        // auto index2 = root->lookupInnerPos(key,keyLength);
-        // cout << "THe root index : " << index2 << " and the total are: " << root->count << endl;
-        // if(index2< root->count && cont){
-        //     cout << "Hi"  << endl;
-        //     root->print2(index2 +1,key, keyLength, keyOut, found_callback );
-        // }
-
-        // if(root->upper != NULL && cont ){
-        //     cout << "last one" << endl;
-        //     root->upper->print2(0,key, keyLength, keyOut, found_callback );
-        // }
-    }
-
     class EytzingerIterator
     {
     private:
@@ -1466,196 +2541,234 @@ struct BTreeNode : public BTreeNodeHeader
         p >>= 1;
         return p - 1;
     }
-
-    bool print2(int index, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
-                const std::function<bool(unsigned int, uint8_t *, unsigned int)>
-                    &found_callback)
-    {
-        if (isInner() && cont)
-        {
-            if (!is_leaf && !is_eyt)
-            {
-                // convertFromEytzinger(slot, count, slot[count]);
-                cout << "is not eyt" << endl;
-            }
-            // cout << "the index is: " << index << ", count: " << count << endl;
-            EytzingerIterator it(count);
-            int x = -1;
-            while (x != index && it.hasNext())
-            {
-                x = it.next();
-            }
-            unsigned i;
-
-            bool continueloop = true;
-            for (i = index; i < count && continueloop && cont; i = it.next())
-            {
-                getChild(i)->print2(0, key, keyLength, keyOut, found_callback);
-
-                // cout << "i: " << i << endl;
-                if (!it.hasNext())
-                    break;
-            }
-            // cout << "we called this: " << findSmallestChildEyt(upper->count) << ", " << upper->count << endl;
-            // cout << "Upper is leaf?: " << upper->is_leaf << endl;
-            // upper->print();
-            upper->print2(findSmallestChildEyt(upper->count), key, keyLength, keyOut, found_callback); // must find the smallest in the eytzinger layout
-            // cout << "we returned to this" << endl;
-        }
-        else if (cont)
-        {
-
-            int pos = lowerBound<false>(key, keyLength);
-            // cout << "The key is : " << key << endl;
-            // cout << "The length is: " << keyLength << endl;
-            // cout << "Prefix: " << prefix_len << endl;
-            // cout << "http://www.bbc.co.uk/programmes/b00wfxh3.rdf " << lowerBound<true>(reinterpret_cast<u8 *>(bbc), 40) << endl;
-
-            // cout << "http://www.bbc.co.uk/programmes/b00wfxh3.rdf " << lowerBound<false>(reinterpret_cast<u8 *>(bbc), 40) << endl;
-            // cout << "The key is : " << key << endl;
-            // cout << "The length is: " << keyLength << endl;
-            // cout << "count is " << count << endl;
-            if (pos == -1)
-                pos = 0;
-            for (unsigned i = pos; i < count; i++)
-            {
-                u8 keyout[getFullKeyLength(i)]; // Adjust size as needed.
-                copyKeyOut(i, keyout, getFullKeyLength(i));
-
-                // // If the key is less than the input key, skip this iteration.
-                // if (cmpKeys(a.data(), keyout, a.size(), getFullKeyLength(i)) > 0)
-                // {
-                //     continue;
-                // }
-                // cout << "We are now doint the " << i << "th iteration out of " << count << " iterationms and is eyt + leaf" << is_eyt << " " << is_leaf << endl;
-                // Processing the key and payload.
-                auto fullKeyLength = getFullKeyLength(i);
-                copyKeyOut(i, keyOut, fullKeyLength);
-                auto payload = (isLarge(i)) ? getPayloadLarge(i) : getPayload(i);
-                auto payloadLength = getPayloadLength(i);
-                string str(reinterpret_cast<const char *>(keyout), getFullKeyLength(i));
-                // cout << counter++ << ": " << string_to_hex(str) << endl;
-                // Here you would place your processing logic. For example, if you were previously printing
-                // the keys, you might instead call a function to process them as needed.
-                bool shouldContinue = found_callback(fullKeyLength, payload, payloadLength);
-                // cout << "The shouldcontinue is: " << shouldContinue << endl;
-                // If the callback indicates not to continue, set cont to false and break out of the loop.
-                if (!shouldContinue)
-                {
-
-                    cont = false;
-                    return false;
-                }
-            }
-        }
-        // else if (cont && upper != nullptr)
-        // {
-        //     upper->print2(findSmallestChildEyt(upper->count), key, keyLength, keyOut, found_callback); // must find the smallest in the eytzinger layout
-        // }
-        return true;
-    }
 };
 
-struct BTree
+template <class Config>
+struct BTreeT
 {
+    using BTreeNode = BTreeNodeT<Config>;
+    using SwipType = typename BTreeNode::SwipType;
+    // bound of the remove path, a split at the root adds one level and leaves at least two children
+    static constexpr unsigned maxHeight = 64;
+    // node, search index and blob pages of the tree, declared before root which is allocated from it
+    typename BTreeNode::Pages pages;
     BTreeNode *root;
-    BTree();
-    bool lookup(u8 *key, unsigned keyLength, u64 &payloadLength, u8 *result);
+    // key the next btree_defragment step starts at, empty at the start of a pass
+    std::vector<u8> defragmentKey;
+    BTreeT();
+    // lookups a batch descends together, enough to keep the line fill buffers of a core busy
+    static constexpr unsigned batchGroup = 16;
+    // one traversal, the view points into the leaf or its blob pages
+    bool lookup(u8 *key, unsigned keyLength, ValueView &value);
+    unsigned lookupBatch(u8 *const *keys, const u16 *keyLengths, unsigned n, ValueView *values);
+    void bulkLoad(const std::function<bool(BulkRecord &)> &source, double fillFactor);
     void lookupInner(u8 *key, unsigned keyLength);
     void splitNode(BTreeNode *node, BTreeNode *parent, u8 *key, unsigned keyLength);
     void splitInner(BTreeNode *toSplit, u8 *key, unsigned keyLength);
+    // splits nodes[level] of a root to leaf path, returns the level the path is valid down to
+    unsigned splitPath(BTreeNode **nodes, unsigned level);
     void insert(u8 *key, unsigned keyLength, u64 payloadLength, u8 *payload = nullptr);
+    // inserts the record as the leaf stores it, lengthField may carry the blob flag
+    void insertRecord(u8 *key, unsigned keyLength, u64 lengthField, u8 *payload);
+    // replaces the value of key, inserts it if missing and insertMissing is set. returns false if nothing was written
+    bool upsert(u8 *key, unsigned keyLength, u64 payloadLength, u8 *payload, bool insertMissing = true);
+    bool upsertRecord(u8 *key, unsigned keyLength, u64 lengthField, u8 *payload, bool insertMissing);
+    void insertSortedBatch(u8 *const *keys, const u16 *keyLengths, u8 *const *values, const u64 *valueLengths, unsigned n);
     bool remove(u8 *key, unsigned keyLength);
-    u64 getPayloadLenLookup(u8 *key, unsigned keyLength);
-    bool merge_help(u8 *, unsigned, BTreeNode *);
-    void makeAllEyt(BTreeNode *node)
-    {
-        if (!node->is_leaf)
-        {
-            if (node->is_eyt)
-            {
-                // for (size_t i = 0; i < node->slotnum; i++)
-                // {
-                //     cout << "[head: " << node->slot[i].head << ", offset: " << node->slot[i].offset << "], ";
-                // }
-                node->convertFromEytzinger(node->slot, node->count, node->slot[node->count]);
-            }
-            // cout << endl;
-            // cout << endl; //[head: 1677721600, offset: 4088],
-
-            // for (size_t i = 0; i < node->slotnum; i++)
-            // {
-            //     cout << node->slot[i].head << ", ";
-            // }
-            // cout << endl;
-            // cout << endl;
-            // cout << endl;
-            // cout << endl;
-            for (size_t i = 0; i < node->count; i++)
-            {
-                makeAllEyt(node->getChild(i));
-            }
-            node->convertToEytzinger(node->slot, node->count);
-        }
-    }
-
-    void makeAllSorted(BTreeNode *node)
-    {
-        if (!node->is_leaf)
-        {
-            if (node->is_eyt)
-            {
-                // for (size_t i = 0; i < node->slotnum; i++)
-                // {
-                //     cout << "[head: " << node->slot[i].head << ", offset: " << node->slot[i].offset << "], ";
-                // }
-                node->convertFromEytzinger(node->slot, node->count, node->slot[node->count]);
-            }
-            // cout << endl;
-            // cout << endl; //[head: 1677721600, offset: 4088],
-
-            // for (size_t i = 0; i < node->slotnum; i++)
-            // {
-            //     cout << node->slot[i].head << ", ";
-            // }
-            // cout << endl;
-            // cout << endl;
-            // cout << endl;
-            // cout << endl;
-            for (size_t i = 0; i < node->count; i++)
-            {
-                makeAllSorted(node->getChild(i));
-            }
-            // cout <<"DONE" <<endl;
-            makeAllSorted(node->upper);
-        }
-    }
+    BTreeNode *findLeaf(u8 *key, unsigned keyLength, BTreeNode **path, unsigned *positions, unsigned &depth);
+    void mergeUp(BTreeNode *node, BTreeNode **path, unsigned *positions, unsigned depth);
+    // adds delta to the record counts on the path to a leaf that gained or lost records
+    void addRecords(BTreeNode **path, unsigned *positions, unsigned depth, int delta);
+    bool mergeRight(BTreeNode *node, BTreeNode *parent, unsigned pos);
+    bool defragmentStep(double targetFill);
+    void collapseRoot();
+    u64 removeRange(u8 *lo, unsigned loLength, u8 *hi, unsigned hiLength);
+    // removes [lo, hi) below node. leftCovered: every key of node is >= lo, rightCovered: every key is < hi
+    u64 removeRange(BTreeNode *node, u8 *lo, unsigned loLength, u8 *hi, unsigned hiLength, bool leftCovered, bool rightCovered);
+    u64 freeSubtree(BTreeNode *node);
+    BTreeNode *emptyChain(BTreeNode *first, BTreeNode *last);
+    void dropChain(BTreeNode *parent, unsigned pos);
+    ~BTreeT();
+};
 
-    ~BTree();
+/**
+ * @brief a position on a leaf record for scans in both directions. the cursor keeps the path
+ * from the root, the next or previous leaf is reached from the deepest inner node on it that has
+ * one, so a seek descends once with the inner search layout and a scan visits each inner node
+ * once. the leaf after the current one, or before it in reverse, is prefetched when a leaf is entered. cursors are
+ * independent, any number of them may read a tree at once. a write to the tree invalidates them
+ */
+template <class Config>
+struct BTreeCursorT
+{
+    using BTreeNode = BTreeNodeT<Config>;
+    BTreeT<Config> *tree;
+    // inner nodes from the root and the child position taken in each, count for the upper
+    BTreeNode *path[BTreeT<Config>::maxHeight];
+    unsigned positions[BTreeT<Config>::maxHeight];
+    unsigned depth = 0;
+    // nullptr once the cursor ran off an end or a seek found nothing
+    BTreeNode *leaf = nullptr;
+    unsigned slot = 0;
+
+    explicit BTreeCursorT(BTreeT<Config> *tree) : tree(tree) {}
+    // moves to the first record >= key, returns false if there is none
+    bool seek(u8 *key, unsigned keyLength);
+    // moves to the last record <= key, returns false if there is none
+    bool seekReverse(u8 *key, unsigned keyLength);
+    // the next or previous record, false at the end of the tree and the cursor is invalid then
+    bool next();
+    bool prev();
+    bool valid() const { return leaf != nullptr; }
+    unsigned keyLength() { return leaf->getFullKeyLength(slot); }
+    // copies the key of the record to out, returns its length
+    unsigned key(u8 *out);
+    // the value as btree_lookup_view returns it
+    ValueView value() { return leaf->getValueView(slot); }
+    bool nextLeaf();
+    bool prevLeaf();
+    void prefetchSibling(bool right);
 };
 
+using BTreeNode = BTreeNodeT<DefaultConfig>;
+using BTree = BTreeT<DefaultConfig>;
+using BTreeCursor = BTreeCursorT<DefaultConfig>;
+
 // create a new tree and return a pointer to it
-BTree *btree_create();
+template <class Config = DefaultConfig>
+BTreeT<Config> *btree_create();
 
 // destroy a tree created by btree_create
-void btree_destroy(BTree *);
+template <class Config>
+void btree_destroy(BTreeT<Config> *);
 
 // return true iff the key was present
-bool btree_remove(BTree *tree, uint8_t *key, uint16_t keyLength);
+template <class Config>
+bool btree_remove(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength);
+
+// replaces exising record if any. values above the blob threshold of the leaves go to blob pages
+template <class Config>
+void btree_insert(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength, uint8_t *value,
+                  uint64_t valueLength);
+
+/**
+ * @brief inserts n records whose keys are in ascending order, like btree_insert one after the other.
+ * the path from the root to the leaf of the last key is kept: a key below the upper bound of that
+ * leaf goes in without a descent, otherwise the descent starts at the deepest node on the path
+ * whose range still holds the key, and a split only goes up the path. a repeated key replaces the
+ * value before it, records with a null key or value are skipped. throws std::invalid_argument at
+ * the first key below the one before, the records before it stay inserted
+ */
+template <class Config>
+void btree_insert_sorted_batch(BTreeT<Config> *tree, uint8_t *const *keys, const uint16_t *keyLengths,
+                               uint8_t *const *values, const uint64_t *valueLengths, unsigned n);
 
-// replaces exising record if any
-void btree_insert(BTree *tree, uint8_t *key, uint16_t keyLength, uint8_t *value,
-                  uint16_t valueLength);
+/**
+ * @brief looks up n keys at once. groups of keys descend one level at a time, every node of the
+ * next level is prefetched before any of them is searched, so the cache misses of the group
+ * overlap. values[i] is the view of keys[i] as btree_lookup_view returns it, a missing key gets
+ * a view with data and blob nullptr. returns the number of keys found
+ */
+template <class Config>
+unsigned btree_lookup_batch(BTreeT<Config> *tree, uint8_t *const *keys, const uint16_t *keyLengths,
+                            unsigned n, ValueView *values);
 
-// returns a pointer to the associated value if present, nullptr otherwise
-uint8_t *btree_lookup(BTree *tree, uint8_t *key, uint16_t keyLength,
-                      uint16_t &payloadLengthOut);
+/**
+ * @brief fills an empty tree from records in strictly ascending key order. source sets the next
+ * record and returns true, or returns false after the last one, the bytes of a record only have
+ * to stay valid until the next call. the leaves are packed to fillFactor of their page on
+ * consecutive pages, the inner levels are built above them with the same fill and get their
+ * search index once. throws std::invalid_argument if the tree is not empty or a key is not above
+ * the one before, the pages written until then are freed with the tree
+ */
+template <class Config>
+void btree_bulk_load(BTreeT<Config> *tree, const std::function<bool(BulkRecord &)> &source,
+                     double fillFactor = 1.0);
 
-// invokes the callback for all records greater than or equal to key, in order.
+/**
+ * @brief removes the records with lo <= key < hi and returns how many. only the nodes on the paths
+ * to lo and hi are searched and trimmed, the subtrees between them are freed whole, their leaves
+ * are only checked for blobs. an empty node per level takes the key range of the freed subtrees
+ * and is merged into its neighbour if that has room, the trimmed nodes are merged like after
+ * btree_remove
+ */
+template <class Config>
+uint64_t btree_remove_range(BTreeT<Config> *tree, uint8_t *lo, uint16_t loLength, uint8_t *hi, uint16_t hiLength);
+
+// replaces the value of key if present and returns true, returns false and changes nothing otherwise
+template <class Config>
+bool btree_update(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength, uint8_t *value,
+                  uint64_t valueLength);
+
+// returns a pointer to a copy of the associated value if present, nullptr otherwise. the caller
+// frees the copy with delete[]
+template <class Config>
+uint8_t *btree_lookup(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength,
+                      uint64_t &payloadLengthOut);
+
+// return true iff the key is present, value then points into the leaf or its blob pages without a
+// copy. the view is only valid until the next write to the tree
+template <class Config>
+bool btree_lookup_view(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength, ValueView &value);
+
+// return true iff the key is present and sets valueLength. the value is copied to buffer only if it
+// fits in bufferLength bytes, otherwise the caller retries with a buffer of valueLength bytes
+template <class Config>
+bool btree_lookup_into(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength, uint8_t *buffer,
+                       uint64_t bufferLength, uint64_t &valueLength);
+
+// page memory of a tree by level, levels[0] are the leaves
+template <class Config>
+MemoryUsage btree_memory_usage(BTreeT<Config> *tree);
+
+// packs the leaves to targetFill of their page and moves them to consecutive pages in key order, one
+// leaf parent at a time. returns false once budget is used up, the next call continues where this one
+// stopped, inserts and removes may run in between. returns true when a pass over the tree is complete
+template <class Config>
+bool btree_defragment(BTreeT<Config> *tree, double targetFill,
+                      std::chrono::microseconds budget = std::chrono::microseconds::max());
+
+// invokes the callback for all records greater than or equal to key, in order, with a BTreeCursorT.
 // the key should be copied to keyOut before the call.
 // the callback should be invoked with keyLength, value pointer, and value
 // length iteration stops if there are no more keys or the callback returns
 // false.
-void btree_scan(BTree *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+template <class Config>
+void btree_scan(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
                 const std::function<bool(unsigned int, uint8_t *, unsigned int)>
-                    &found_callback);
\ No newline at end of file
+                    &found_callback);
+
+// same as btree_scan, the callback gets a view of the value that streams blob values chunk by chunk
+template <class Config>
+void btree_scan(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+                const std::function<bool(unsigned int, const ValueView &)> &found_callback);
+
+/**
+ * @brief order statistics of a tree with a countRecords config such as CountedConfig. each one
+ * descends once and adds up the counts of the inner records left of the path, no record is visited
+ */
+// number of records with a key below key
+template <class Config>
+uint64_t btree_rank(BTreeT<Config> *tree, uint8_t *key, uint16_t keyLength);
+
+// number of records with lo <= key < hi
+template <class Config>
+uint64_t btree_count_range(BTreeT<Config> *tree, uint8_t *lo, uint16_t loLength, uint8_t *hi, uint16_t hiLength);
+
+// moves the cursor to the record at position rank in key order, 0 is the first record. returns
+// false and leaves the cursor invalid if the tree has no more than rank records
+template <class Config>
+bool btree_select(BTreeT<Config> *tree, uint64_t rank, BTreeCursorT<Config> &cursor);
+
+// invokes the callback for all records less than or equal to key, in descending order, same
+// callback contract as btree_scan
+template <class Config>
+void btree_scan_reverse(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+                        const std::function<bool(unsigned int, uint8_t *, unsigned int)>
+                            &found_callback);
+
+template <class Config>
+void btree_scan_reverse(BTreeT<Config> *tree, uint8_t *key, unsigned keyLength, uint8_t *keyOut,
+                        const std::function<bool(unsigned int, const ValueView &)> &found_callback);
+
+#include "fixed_key.hpp"
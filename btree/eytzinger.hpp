@@ -0,0 +1,117 @@
+/**
+ * @file eytzinger.hpp
+ * @brief index math and in place conversion between sorted and eytzinger order
+ *
+ * eytzinger nodes k are 1-indexed (children 2k and 2k + 1), sorted positions
+ * are 0-indexed. a tree of n elements is a perfect tree of height h whose last
+ * level only has its m leftmost leaves, so both mappings are a few bit
+ * operations instead of an in-order walk.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+// height of the eytzinger tree holding n > 0 elements
+static inline unsigned eytzingerHeight(unsigned n) { return 32 - __builtin_clz(n); }
+
+// number of elements on the (partially filled) last level
+static inline unsigned eytzingerLastLevel(unsigned n) { return n - ((1u << (eytzingerHeight(n) - 1)) - 1); }
+
+// sorted position of the eytzinger node k
+static inline unsigned eytzingerToSorted(unsigned k, unsigned n)
+{
+    unsigned h = eytzingerHeight(n);
+    unsigned depth = 31 - __builtin_clz(k);
+    // in-order position in the perfect tree
+    unsigned p = (((k - (1u << depth)) << 1) + 1) << (h - 1 - depth);
+    p--;
+    unsigned m = eytzingerLastLevel(n);
+    // past the last existing leaf only every second in-order position exists
+    return p < 2 * m ? p : (p + 2 * m - 1) / 2;
+}
+
+// eytzinger node of the sorted position r
+static inline unsigned sortedToEytzinger(unsigned r, unsigned n)
+{
+    unsigned h = eytzingerHeight(n);
+    unsigned m = eytzingerLastLevel(n);
+    unsigned p = r < 2 * m ? r : 2 * r - 2 * m + 1;
+    unsigned i = p + 1;
+    return ((1u << h) + i) >> (__builtin_ctz(i) + 1);
+}
+
+/**
+ * @brief calls fn(k, eytzingerToSorted(k, n)) for k = 1 .. n.
+ * on one level the in-order positions of the perfect tree are an arithmetic
+ * sequence, so the loop only steps and folds them instead of mapping every node.
+ */
+template <class Fn>
+static inline void forEachEytzinger(unsigned n, Fn fn)
+{
+    if (n == 0)
+        return;
+    unsigned h = eytzingerHeight(n);
+    unsigned m2 = 2 * eytzingerLastLevel(n);
+    unsigned k = 1;
+    for (unsigned depth = 0; depth < h; depth++)
+    {
+        unsigned step = 1u << (h - depth);
+        unsigned end = std::min(n + 1, 2u << depth);
+        for (unsigned p = (step >> 1) - 1; k < end; k++, p += step)
+            fn(k, p < m2 ? p : (p + m2 - 1) / 2);
+    }
+}
+
+/**
+ * @brief moves the element at i to dest(i) for all i < n, without a temporary array.
+ * every cycle of the permutation is rotated once through a single carried element.
+ * a bitmap on the stack remembers the finished positions, it is 1 bit for each of
+ * the MaxN elements the caller can have (64 bytes for the 498 slots of a 4KB page)
+ * instead of a copy of the array.
+ */
+template <class Value, size_t MaxN, class Array, class Dest>
+static void permuteInPlace(Array &a, unsigned n, Dest dest)
+{
+    assert(n <= MaxN);
+    uint64_t done[(MaxN + 63) / 64];
+    memset(done, 0, (n + 63) / 64 * sizeof(uint64_t));
+    for (unsigned i = 0; i < n; i++)
+    {
+        if (done[i / 64] & (1ull << (i % 64)))
+            continue;
+        Value carry = a[i];
+        unsigned j = dest(i);
+        for (; j != i; j = dest(j))
+        {
+            Value tmp = a[j];
+            a[j] = carry;
+            carry = tmp;
+            done[j / 64] |= 1ull << (j % 64);
+        }
+        a[i] = carry;
+    }
+}
+
+// sorted -> eytzinger order, element k - 1 of the result is eytzinger node k. MaxN bounds n, the capacity of the node
+template <class Value, size_t MaxN, class Array>
+static void toEytzingerInPlace(Array &a, unsigned n)
+{
+    if (n == 0)
+        return;
+    permuteInPlace<Value, MaxN>(a, n, [n](unsigned r)
+                          { return sortedToEytzinger(r, n) - 1; });
+}
+
+// eytzinger -> sorted order
+template <class Value, size_t MaxN, class Array>
+static void fromEytzingerInPlace(Array &a, unsigned n)
+{
+    if (n == 0)
+        return;
+    permuteInPlace<Value, MaxN>(a, n, [n](unsigned i)
+                          { return eytzingerToSorted(i + 1, n); });
+}
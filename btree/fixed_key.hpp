@@ -0,0 +1,393 @@
+/**
+ * @file fixed_key.hpp
+ * @brief B+ tree node for fixed width integer keys
+ *
+ * BTreeT<FixedKey<uint64_t>> keeps the keys of a node as native integers in a
+ * dense sorted array: no prefix, no heads, no slot offsets, a lookup is a
+ * branchless binary search with integer compares. values have a fixed width
+ * as well and sit in a second dense array of the leaf, inner nodes keep their
+ * children there. a key is the big endian byte string of the integer, so the
+ * integer order is the memcmp order the rest of the tree uses. the tree
+ * algorithms of BTreeT (insert with splits, remove with merges, scan) are
+ * shared with the slotted node.
+ */
+
+#pragma once
+
+#include "btree.hpp"
+
+#include <cstddef>
+#include <type_traits>
+
+template <class K, unsigned ValueSize = sizeof(K)>
+struct FixedKey
+{
+    static_assert(std::is_unsigned<K>::value && sizeof(K) >= 2 && sizeof(K) <= 8, "fixed keys are unsigned integers of 2 to 8 bytes");
+    using Key = K;
+    static constexpr unsigned valueSize = ValueSize;
+
+    struct Slots
+    {
+        static constexpr const char *name = "fixed";
+    };
+    using Lengths = FixedLengths<ValueSize>;
+    // the children stay 8 byte pointers in their own dense array
+    using Addressing = PointerAddressing;
+    using InnerLayout = SortedLayout;
+    using LeafLayout = SortedLayout;
+    static constexpr unsigned innerPageSize = BTREE_INNER_PAGE_SIZE;
+    static constexpr unsigned leafPageSize = BTREE_LEAF_PAGE_SIZE;
+};
+
+template <class K, unsigned ValueSize>
+struct BTreeNodeT<FixedKey<K, ValueSize>>
+{
+    using Config = FixedKey<K, ValueSize>;
+    using BTreeNode = BTreeNodeT<Config>;
+    using SwipType = BTreeNode *;
+    using Pages = PageAllocatorT<typename Config::Addressing>;
+
+    static constexpr unsigned innerPageSize = Config::innerPageSize;
+    static constexpr unsigned leafPageSize = Config::leafPageSize;
+    static constexpr unsigned maxPageSize = std::max(innerPageSize, leafPageSize);
+    static constexpr unsigned headerSize = 16;
+    // the children of an inner node start at the next 8 byte boundary after the keys
+    static constexpr unsigned innerCapacity = (innerPageSize - headerSize - sizeof(SwipType)) / (sizeof(K) + sizeof(SwipType));
+    static constexpr unsigned leafCapacity = (leafPageSize - headerSize) / (sizeof(K) + ValueSize);
+    static constexpr unsigned childOffset = (innerCapacity * sizeof(K) + sizeof(SwipType) - 1) / sizeof(SwipType) * sizeof(SwipType);
+    // keys are never truncated, the split code of BTreeT still asks for the prefix of the parent
+    static constexpr unsigned prefix_len = 0;
+
+    BTreeNode *upper = nullptr;
+    u16 count = 0;
+    bool is_leaf;
+    alignas(8) u8 data[maxPageSize - headerSize];
+
+    BTreeNodeT(bool isLeaf)
+        : is_leaf(isLeaf)
+    {
+        static_assert(offsetof(BTreeNode, data) == headerSize, "header does not match headerSize");
+    }
+
+    inline bool isInner() { return !is_leaf; }
+    inline unsigned pageSize() const { return is_leaf ? leafPageSize : innerPageSize; }
+    inline unsigned underFull() const { return pageSize() * 0.6; }
+    inline unsigned capacity() const { return is_leaf ? leafCapacity : innerCapacity; }
+    // bytes of one entry, a key with its value or child
+    inline unsigned entrySize() const { return sizeof(K) + (is_leaf ? ValueSize : sizeof(SwipType)); }
+
+    inline K *keys() { return reinterpret_cast<K *>(data); }
+    inline SwipType *children() { return reinterpret_cast<SwipType *>(data + childOffset); }
+    inline u8 *values() { return data + leafCapacity * sizeof(K); }
+
+    inline SwipType &getChild(unsigned slot_id) { return children()[slot_id]; }
+    inline u8 *getValue(unsigned slot_id) { return values() + slot_id * ValueSize; }
+    inline u64 getPayloadLength(unsigned) { return ValueSize; }
+    inline ValueView getValueView(unsigned slot_id) { return ValueView{getValue(slot_id), nullptr, ValueSize}; }
+    // values have a fixed width, they never go to blob pages
+    static constexpr u64 blobThreshold = ~u64(0);
+    static constexpr u64 blobFlag = 0;
+    static bool acceptsPayload(u64 payloadLength) { return payloadLength == ValueSize; }
+    inline unsigned getFullKeyLength(unsigned) { return sizeof(K); }
+    inline void copyKeyOut(unsigned slot_id, u8 *out, unsigned) { storeKey(keys()[slot_id], out); }
+
+    static BTreeNode *allocate(Pages &pages, bool isLeaf) { return new (pages.allocate(isLeaf ? leafPageSize : innerPageSize)) BTreeNode(isLeaf); }
+    static void release(BTreeNode *node) { Pages::of(node)->release(node, node->is_leaf ? leafPageSize : innerPageSize); }
+    static BTreeNode *makeLeaf(Pages &pages) { return allocate(pages, true); }
+    static BTreeNode *makeInner(Pages &pages) { return allocate(pages, false); }
+    static BTreeNode *allocateFresh(Pages &pages, bool isLeaf) { return new (pages.allocateFresh(isLeaf ? leafPageSize : innerPageSize)) BTreeNode(isLeaf); }
+
+    static K loadKey(u8 *key)
+    {
+        K k;
+        memcpy(&k, key, sizeof(K));
+        return swap(k);
+    }
+    static void storeKey(K k, u8 *out)
+    {
+        k = swap(k);
+        memcpy(out, &k, sizeof(K));
+    }
+
+    static int cmpKeys(u8 *keyA, u8 *keyB, unsigned lengthA, unsigned lengthB)
+    {
+        auto res = std::memcmp(keyA, keyB, min(lengthA, lengthB));
+        if (res)
+            return res;
+        return (lengthA - lengthB);
+    }
+
+    // position of the first key >= k
+    unsigned lowerBoundKey(K k)
+    {
+        K *base = keys();
+        unsigned n = count;
+        if (n == 0)
+            return 0;
+        while (n > 1)
+        {
+            unsigned half = n / 2;
+            base = base[half - 1] < k ? base + half : base;
+            n -= half;
+        }
+        return (base - keys()) + (*base < k);
+    }
+
+    /**
+     * @brief lowerBound on the byte string key. keys of another width can not
+     * be stored, but they still have a place in the order: a shorter key sorts
+     * like its zero padded width, a longer one right after its truncated prefix
+     */
+    template <bool equalityOnly = false>
+    unsigned lowerBound(u8 *key, unsigned keyLength)
+    {
+        if (keyLength == sizeof(K))
+        {
+            K k = loadKey(key);
+            unsigned pos = lowerBoundKey(k);
+            if (equalityOnly)
+                return (pos < count && keys()[pos] == k) ? pos : -1;
+            return pos;
+        }
+        if (equalityOnly)
+            return -1;
+        u8 padded[sizeof(K)] = {};
+        memcpy(padded, key, min<unsigned>(keyLength, sizeof(K)));
+        K k = loadKey(padded);
+        if (keyLength < sizeof(K))
+            return lowerBoundKey(k);
+        return k == K(~K(0)) ? count : lowerBoundKey(k + 1);
+    }
+
+    template <bool equalityOnly = false>
+    unsigned search(u8 *key, unsigned keyLength) { return lowerBound<equalityOnly>(key, keyLength); }
+
+    // the first probe of the binary search, the header line is prefetched with the node
+    void prefetchSearch() { __builtin_prefetch(keys() + count / 2); }
+    void prefetchRecord(unsigned slot_id) { __builtin_prefetch(getValue(slot_id)); }
+
+    unsigned lookupInnerPos(u8 *key, unsigned keyLength) { return lowerBound<false>(key, keyLength); }
+    BTreeNode *lookupInner(u8 *key, unsigned keyLength)
+    {
+        unsigned pos = lookupInnerPos(key, keyLength);
+        return pos == count ? upper : getChild(pos);
+    }
+
+    bool isSorted()
+    {
+        for (unsigned i = 1; i < count; i++)
+            if (keys()[i - 1] >= keys()[i])
+                return false;
+        return true;
+    }
+
+    static unsigned spaceNeeded(unsigned, unsigned) { return sizeof(K) + sizeof(SwipType); }
+    unsigned freeSpace() { return (capacity() - count) * entrySize(); }
+    unsigned spacePostCompact() { return freeSpace(); }
+    bool allocateSpace(unsigned spaceNeeded) { return spaceNeeded <= freeSpace(); }
+
+    // moves the entries [from, count) by shift slots, the caller fixes count
+    void moveEntries(unsigned from, int shift)
+    {
+        memmove(keys() + from + shift, keys() + from, sizeof(K) * (count - from));
+        if (is_leaf)
+            memmove(getValue(from + shift), getValue(from), ValueSize * (count - from));
+        else
+            memmove(children() + from + shift, children() + from, sizeof(SwipType) * (count - from));
+    }
+
+    // copies n entries starting at srcSlot to dst, which must have room for them at dstSlot
+    void copyEntries(BTreeNode *dst, unsigned dstSlot, unsigned srcSlot, unsigned n)
+    {
+        memcpy(dst->keys() + dstSlot, keys() + srcSlot, sizeof(K) * n);
+        if (is_leaf)
+            memcpy(dst->getValue(dstSlot), getValue(srcSlot), ValueSize * n);
+        else
+            memcpy(dst->children() + dstSlot, children() + srcSlot, sizeof(SwipType) * n);
+    }
+
+    bool insert(u8 *key, unsigned keyLength, SwipType value, u8 *payload = nullptr)
+    {
+        if (keyLength != sizeof(K))
+            throw std::invalid_argument("key length does not match the fixed key width");
+        if (is_leaf && u64(value) != ValueSize)
+            throw std::invalid_argument("value length does not match the fixed value width");
+        if (count == capacity())
+            return false;
+        K k = loadKey(key);
+        unsigned pos = lowerBoundKey(k);
+        moveEntries(pos, 1);
+        keys()[pos] = k;
+        if (is_leaf)
+            memcpy(getValue(pos), payload, ValueSize);
+        else
+            getChild(pos) = value;
+        count++;
+        assert(isSorted());
+        return true;
+    }
+
+    // values have one width, an update always fits in place
+    bool updatePayload(unsigned slot_id, SwipType value, u8 *payload)
+    {
+        if (u64(value) != ValueSize)
+            throw std::invalid_argument("value length does not match the fixed value width");
+        memcpy(getValue(slot_id), payload, ValueSize);
+        return true;
+    }
+
+    // inner nodes keep no record counts, btree_rank and friends need a slotted node config
+    static constexpr bool countRecords = false;
+
+    // bulk loads pack entries, the node has no prefix and no fences. separators are whole keys
+    static constexpr bool truncatedSeparators = false;
+    static unsigned bulkRecordSpace(bool isLeaf, unsigned, u64, unsigned) { return sizeof(K) + (isLeaf ? ValueSize : sizeof(SwipType)); }
+    static unsigned bulkNodeSpace(bool isLeaf, unsigned, unsigned, unsigned) { return headerSize + (isLeaf ? 0 : sizeof(SwipType)); }
+    void setFences(u8 *, unsigned, u8 *, unsigned) {}
+    void finishBulk() {}
+
+    // appends an entry above all others, the bulk load checked the space
+    void append(u8 *key, unsigned keyLength, SwipType value, u8 *payload)
+    {
+        if (keyLength != sizeof(K))
+            throw std::invalid_argument("key length does not match the fixed key width");
+        if (is_leaf && u64(value) != ValueSize)
+            throw std::invalid_argument("value length does not match the fixed value width");
+        assert(count < capacity());
+        keys()[count] = loadKey(key);
+        if (is_leaf)
+            memcpy(getValue(count), payload, ValueSize);
+        else
+            getChild(count) = value;
+        count++;
+    }
+
+    bool removeSlot(unsigned slot_id)
+    {
+        moveEntries(slot_id + 1, -1);
+        count--;
+        return true;
+    }
+
+    bool remove(u8 *key, unsigned keyLength)
+    {
+        int slot_id = lowerBound<true>(key, keyLength);
+        if (slot_id == -1)
+            return false;
+        return removeSlot(slot_id);
+    }
+
+    void removeSlots(unsigned from, unsigned to)
+    {
+        moveEntries(to, -int(to - from));
+        count -= to - from;
+    }
+    // values are inline and nodes have no fences
+    void releaseBlobs() {}
+    void setFencesOf(BTreeNode *, BTreeNode *) {}
+
+    struct SeparatorInfo
+    {
+        unsigned length;
+        unsigned slot;
+        bool trunc;
+    };
+
+    SeparatorInfo findSep() { return SeparatorInfo{sizeof(K), static_cast<unsigned>(count / 2), false}; }
+    void getSep(u8 *sepKeyOut, SeparatorInfo info) { storeKey(keys()[info.slot], sepKeyOut); }
+
+    // moves the entries up to the separator into a new left node, the separator of an inner node becomes its upper
+    void split(BTreeNode *parent, unsigned sepSlot, u8 *sepKey, unsigned sepLength)
+    {
+        BTreeNode *nodeLeft = allocate(*Pages::of(this), is_leaf);
+        bool success = parent->insert(sepKey, sepLength, nodeLeft);
+        assert(success);
+        static_cast<void>(success);
+        unsigned leftCount = is_leaf ? sepSlot + 1 : sepSlot;
+        copyEntries(nodeLeft, 0, 0, leftCount);
+        nodeLeft->count = leftCount;
+        unsigned moved = leftCount;
+        if (!is_leaf)
+        {
+            nodeLeft->upper = getChild(sepSlot);
+            moved++;
+        }
+        moveEntries(moved, -int(moved));
+        count -= moved;
+    }
+
+    // repackLeaves of the slotted node, the separators are the last keys of the new leaves
+    bool repackLeaves(double targetFill)
+    {
+        unsigned children = count + 1;
+        BTreeNode *old[children];
+        unsigned total = 0;
+        for (unsigned i = 0; i < children; i++)
+        {
+            old[i] = i < count ? getChild(i) : upper;
+            total += old[i]->count;
+        }
+        unsigned perLeaf = max(1u, min(leafCapacity, unsigned(targetFill * leafCapacity)));
+        unsigned leaves = max(1u, (total + perLeaf - 1) / perLeaf);
+        if (leaves - 1 > innerCapacity)
+            return false;
+
+        Pages &pages = *Pages::of(this);
+        BTreeNode *fresh[leaves];
+        unsigned i = 0, s = 0;
+        for (unsigned j = 0; j < leaves; j++)
+        {
+            BTreeNode *leaf = new (pages.allocateFresh(leafPageSize)) BTreeNode(true);
+            unsigned want = min(perLeaf, total - j * perLeaf);
+            while (leaf->count < want)
+            {
+                for (; s == old[i]->count; i++)
+                    s = 0;
+                unsigned n = min(want - leaf->count, old[i]->count - s);
+                old[i]->copyEntries(leaf, leaf->count, s, n);
+                leaf->count += n;
+                s += n;
+            }
+            fresh[j] = leaf;
+        }
+        for (unsigned j = 0; j + 1 < leaves; j++)
+        {
+            keys()[j] = fresh[j]->keys()[fresh[j]->count - 1];
+            getChild(j) = fresh[j];
+        }
+        upper = fresh[leaves - 1];
+        count = leaves - 1;
+        for (unsigned i = 0; i < children; i++)
+            release(old[i]);
+        return true;
+    }
+
+    // the dense arrays have no holes, everything not live is free
+    void accountMemory(LevelMemory &level)
+    {
+        unsigned size = is_leaf ? leafPageSize : innerPageSize;
+        level.pages++;
+        level.bytes += size;
+        level.liveBytes += count * entrySize();
+        level.freeBytes += freeSpace();
+    }
+
+    // merges this node into its right sibling, slot_id is the parent entry of this node
+    bool merge(unsigned slot_id, BTreeNode *parent, BTreeNode *right)
+    {
+        unsigned extra = is_leaf ? 0 : 1;
+        if (count + extra + right->count > capacity())
+            return false;
+        right->moveEntries(0, count + extra);
+        copyEntries(right, 0, 0, count);
+        if (!is_leaf)
+        {
+            right->keys()[count] = parent->keys()[slot_id];
+            right->getChild(count) = upper;
+        }
+        right->count += count + extra;
+        parent->removeSlot(slot_id);
+        assert(right->isSorted());
+        return true;
+    }
+};
@@ -0,0 +1,181 @@
+/**
+ * @file key_encoding.hpp
+ * @brief order preserving encoding of typed and composite keys
+ *
+ * the tree orders keys by memcmp, so typed keys have to be turned into byte
+ * strings whose memcmp order is their logical order:
+ * - unsigned integers are stored big endian
+ * - signed integers additionally flip the sign bit
+ * - floats and doubles flip the sign bit of positive and all bits of
+ *   negative values, -0.0 is stored as 0.0
+ * - strings inside a composite key escape 0x00 as 0x00 0xff and end with
+ *   0x00 0x00, so a string sorts before all of its extensions
+ *
+ * KeyEncoder appends components, KeyDecoder reads them back in the same order.
+ * a key that is a single string needs no encoding at all.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace key_encoding
+{
+    template <class T>
+    static inline T toBigEndian(T x)
+    {
+        if constexpr (sizeof(T) == 1)
+            return x;
+        else if constexpr (sizeof(T) == 2)
+            return __builtin_bswap16(x);
+        else if constexpr (sizeof(T) == 4)
+            return __builtin_bswap32(x);
+        else
+            return __builtin_bswap64(x);
+    }
+
+    // unsigned integer of the same width as T
+    template <class T>
+    using Bits = std::conditional_t<sizeof(T) == 1, uint8_t,
+                                    std::conditional_t<sizeof(T) == 2, uint16_t,
+                                                       std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+
+    // bits of value whose unsigned order is the order of value
+    template <class T>
+    static inline Bits<T> orderedBits(T value)
+    {
+        using U = Bits<T>;
+        constexpr U sign = U(1) << (8 * sizeof(T) - 1);
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (value == T(0))
+                value = T(0);
+            U bits;
+            memcpy(&bits, &value, sizeof(T));
+            return (bits & sign) ? U(~bits) : U(bits | sign);
+        }
+        else if constexpr (std::is_signed_v<T>)
+            return U(value) ^ sign;
+        else
+            return U(value);
+    }
+
+    template <class T>
+    static inline T fromOrderedBits(Bits<T> bits)
+    {
+        using U = Bits<T>;
+        constexpr U sign = U(1) << (8 * sizeof(T) - 1);
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            bits = (bits & sign) ? U(bits & ~sign) : U(~bits);
+            T value;
+            memcpy(&value, &bits, sizeof(T));
+            return value;
+        }
+        else if constexpr (std::is_signed_v<T>)
+            return T(bits ^ sign);
+        else
+            return T(bits);
+    }
+}
+
+struct KeyEncoder
+{
+    std::vector<uint8_t> bytes;
+
+    template <class T>
+    KeyEncoder &add(T value)
+    {
+        if constexpr (std::is_arithmetic_v<T>)
+        {
+            static_assert(!std::is_same_v<T, bool>, "encode bools as uint8_t");
+            auto bits = key_encoding::toBigEndian(key_encoding::orderedBits(value));
+            const uint8_t *raw = reinterpret_cast<const uint8_t *>(&bits);
+            bytes.insert(bytes.end(), raw, raw + sizeof(bits));
+        }
+        else
+        {
+            std::string_view s(value);
+            for (char c : s)
+            {
+                bytes.push_back(uint8_t(c));
+                if (c == 0)
+                    bytes.push_back(0xff);
+            }
+            bytes.push_back(0);
+            bytes.push_back(0);
+        }
+        return *this;
+    }
+
+    template <class... Ts>
+    KeyEncoder &addTuple(const std::tuple<Ts...> &tuple)
+    {
+        std::apply([this](const Ts &...values)
+                   { (add(values), ...); },
+                   tuple);
+        return *this;
+    }
+
+    uint8_t *data() { return bytes.data(); }
+    unsigned size() const { return bytes.size(); }
+    void clear() { bytes.clear(); }
+};
+
+struct KeyDecoder
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+
+    KeyDecoder(const uint8_t *key, unsigned keyLength)
+        : pos(key), end(key + keyLength) {}
+
+    template <class T>
+    T get()
+    {
+        if constexpr (std::is_arithmetic_v<T>)
+        {
+            key_encoding::Bits<T> bits;
+            if (end - pos < long(sizeof(T)))
+                throw std::out_of_range("key is too short for the component");
+            memcpy(&bits, pos, sizeof(T));
+            pos += sizeof(T);
+            return key_encoding::fromOrderedBits<T>(key_encoding::toBigEndian(bits));
+        }
+        else
+        {
+            static_assert(std::is_same_v<T, std::string>, "strings decode to std::string");
+            std::string s;
+            for (;;)
+            {
+                if (end - pos < 2)
+                    throw std::out_of_range("unterminated string component");
+                if (pos[0] == 0 && pos[1] == 0)
+                    break;
+                s.push_back(char(pos[0]));
+                pos += pos[0] == 0 ? 2 : 1;
+            }
+            pos += 2;
+            return s;
+        }
+    }
+
+    template <class... Ts>
+    std::tuple<Ts...> getTuple() { return std::tuple<Ts...>{get<Ts>()...}; }
+
+    bool done() const { return pos == end; }
+};
+
+// single component keys
+template <class T>
+std::vector<uint8_t> encodeKey(T value) { return KeyEncoder().add(value).bytes; }
+
+template <class T>
+T decodeKey(const uint8_t *key, unsigned keyLength) { return KeyDecoder(key, keyLength).get<T>(); }
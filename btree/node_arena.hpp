@@ -0,0 +1,125 @@
+/**
+ * @file node_arena.hpp
+ * @brief node addressing: raw child pointers or 32 bit page ids into one arena
+ *
+ * the addressing of a config decides how inner records and the upper field
+ * refer to nodes and where the chunks of the page allocator come from:
+ * - PointerAddressing stores 8 byte BTreeNode pointers, chunks come from the heap
+ * - ArenaAddressing stores 4 byte page ids, chunks come from NodeArena
+ *
+ * the arena reserves one range of virtual memory up front, page id i is the
+ * 4KB unit at base + i * unit. unit 0 is the header of the first chunk and
+ * never a node, id 0 is the null node. a larger page takes several
+ * consecutive units and is referenced by its first one. since a node only
+ * holds ids, the node pages of a tree do not depend on where the arena is
+ * mapped.
+ */
+
+#pragma once
+
+#include "page_allocator.hpp"
+
+#include <sys/mman.h>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// bytes of virtual memory reserved for the arena, backed lazily by the kernel. 32 bit ids address up to 16TB
+#ifndef BTREE_ARENA_RESERVE
+#define BTREE_ARENA_RESERVE (uint64_t(1) << 40)
+#endif
+
+struct NodeArena
+{
+    static constexpr uint64_t unit = PageAllocatorBase::unit;
+    static constexpr unsigned unitShift = 12;
+    static constexpr uint64_t reserve = BTREE_ARENA_RESERVE;
+    static_assert(reserve / unit <= (uint64_t(1) << 32), "page ids are 32 bit");
+    static_assert(unit == uint64_t(1) << unitShift, "unitShift does not match unit");
+
+    static inline uint8_t *base = nullptr;
+    // bytes handed out as chunks so far
+    static inline uint64_t used = 0;
+    // chunks of destroyed trees
+    static inline std::vector<uint8_t *> freeChunks;
+
+    // chunks are aligned to their size, all chunks of the page allocator have the same size
+    static void *allocateChunk(uint64_t size)
+    {
+        if (!freeChunks.empty())
+        {
+            uint8_t *chunk = freeChunks.back();
+            freeChunks.pop_back();
+            return chunk;
+        }
+        if (!base)
+        {
+            void *range = mmap(nullptr, reserve + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (range == MAP_FAILED)
+                throw std::bad_alloc();
+            base = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(range) + size - 1) & ~(size - 1));
+        }
+        if (used + size > reserve)
+            throw std::bad_alloc();
+        uint8_t *chunk = base + used;
+        used += size;
+        return chunk;
+    }
+
+    // the memory goes back to the kernel, the range stays reserved for the next tree
+    static void releaseChunk(void *chunk, uint64_t size)
+    {
+        madvise(chunk, size, MADV_DONTNEED);
+        freeChunks.push_back(static_cast<uint8_t *>(chunk));
+    }
+
+    static inline void *pageOf(uint32_t id) { return id ? base + (uint64_t(id) << unitShift) : nullptr; }
+    static inline uint32_t idOf(const void *page)
+    {
+        if (!page)
+            return 0;
+        assert(static_cast<const uint8_t *>(page) > base && static_cast<const uint8_t *>(page) < base + used);
+        return (static_cast<const uint8_t *>(page) - base) >> unitShift;
+    }
+};
+
+// nodes refer to each other by pointer, the chunks come from the heap
+struct PointerAddressing
+{
+    static constexpr const char *name = "pointer";
+
+    template <class Node>
+    using Ref = Node *;
+
+    static void *allocateChunk(uint64_t size)
+    {
+        void *chunk = std::aligned_alloc(size, size);
+        if (!chunk)
+            throw std::bad_alloc();
+        return chunk;
+    }
+    static void releaseChunk(void *chunk, uint64_t) { std::free(chunk); }
+};
+
+// nodes refer to each other by 32 bit page id, the chunks come from the NodeArena
+struct ArenaAddressing
+{
+    static constexpr const char *name = "arena";
+
+    // a stored page id that reads and assigns like a node pointer
+    template <class Node>
+    struct Ref
+    {
+        uint32_t id;
+
+        Ref(Node *node = nullptr) : id(NodeArena::idOf(node)) {}
+        operator Node *() const { return static_cast<Node *>(NodeArena::pageOf(id)); }
+        Node *operator->() const { return *this; }
+    };
+
+    static void *allocateChunk(uint64_t size) { return NodeArena::allocateChunk(size); }
+    static void releaseChunk(void *chunk, uint64_t size) { NodeArena::releaseChunk(chunk, size); }
+};
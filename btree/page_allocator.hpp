@@ -0,0 +1,232 @@
+/**
+ * @file page_allocator.hpp
+ * @brief per tree allocator for node, search index and blob pages
+ *
+ * pages are cut from 2MB chunks aligned to their size, so the chunk of a page
+ * is found by masking its address. the first 4KB of a chunk is its header
+ * with the allocator that owns it, node code that only has a page can free to
+ * or allocate from the tree it belongs to. pages are multiples of 4KB and 4KB
+ * aligned. released pages are merged with free neighbours in their chunk and
+ * go to a free list per run length, an allocation takes the shortest run that
+ * fits and frees the rest of it, so page sizes can mix. the header of a chunk
+ * keeps the boundary tags of its free runs. the whole tree is freed by handing
+ * the chunks back to their source.
+ *
+ * the chunks come from Source::allocateChunk, the addressing of the config:
+ * the heap for pointers, the NodeArena for page ids.
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct PageAllocatorBase
+{
+    static constexpr uint64_t unit = 4096;
+    static constexpr uint64_t chunkSize = uint64_t(1) << 21;
+    static constexpr uint64_t chunkUnits = chunkSize / unit;
+    // madvise(MADV_HUGEPAGE) on new chunks, off for comparisons with 4KB pages
+    static inline bool hugePages = true;
+
+    static uint64_t unitsOf(uint64_t bytes) { return (bytes + unit - 1) / unit; }
+};
+
+template <class Source>
+struct PageAllocatorT : PageAllocatorBase
+{
+    struct ChunkHeader
+    {
+        PageAllocatorT *owner;
+        ChunkHeader *next;
+        // units of the free run that starts at a unit, 0 if none starts there
+        uint16_t runLength[chunkUnits];
+        // first unit of the free run that ends at a unit, stale unless runLength confirms it
+        uint16_t runStart[chunkUnits];
+    };
+    static_assert(sizeof(ChunkHeader) <= unit, "the chunk header has one unit");
+    struct FreePage
+    {
+        FreePage *next;
+        FreePage *prev;
+    };
+
+    ChunkHeader *chunks = nullptr;
+    // unused units at the end of the newest chunk
+    uint8_t *bump = nullptr;
+    uint8_t *bumpEnd = nullptr;
+    // free runs by their number of units
+    std::vector<FreePage *> freeLists = std::vector<FreePage *>(chunkUnits, nullptr);
+    // bit n is set if freeLists[n] is not empty
+    uint64_t nonEmpty[chunkUnits / 64] = {};
+    uint64_t chunkCount = 0;
+    uint64_t usedUnits = 0;
+
+    PageAllocatorT() = default;
+    PageAllocatorT(const PageAllocatorT &) = delete;
+    PageAllocatorT &operator=(const PageAllocatorT &) = delete;
+    ~PageAllocatorT() { releaseAll(); }
+
+    static PageAllocatorT *of(const void *page)
+    {
+        return reinterpret_cast<ChunkHeader *>(reinterpret_cast<uintptr_t>(page) & ~(chunkSize - 1))->owner;
+    }
+
+    void *allocate(uint64_t bytes)
+    {
+        uint64_t units = unitsOf(bytes);
+        assert(units > 0 && units < chunkUnits);
+        uint64_t length = shortestRun(units);
+        if (length == chunkUnits)
+            return allocateFresh(bytes);
+        FreePage *page = freeLists[length];
+        unlink(page, length);
+        usedUnits += units;
+        if (length > units)
+            insertRun(reinterpret_cast<uint8_t *>(page) + units * unit, length - units);
+        return page;
+    }
+
+    // a page from the end of the newest chunk, without the free lists. consecutive calls get consecutive pages
+    void *allocateFresh(uint64_t bytes)
+    {
+        uint64_t units = unitsOf(bytes);
+        assert(units > 0 && units < chunkUnits);
+        usedUnits += units;
+        if (bump + units * unit > bumpEnd)
+            addChunk();
+        void *page = bump;
+        bump += units * unit;
+        return page;
+    }
+
+    void release(void *page, uint64_t bytes)
+    {
+        uint64_t units = unitsOf(bytes);
+        assert(of(page) == this);
+        usedUnits -= units;
+        ChunkHeader *chunk = chunkOf(page);
+        uint64_t first = unitIn(page);
+        // the free runs right and left of the page join it
+        if (first + units < chunkUnits && chunk->runLength[first + units])
+        {
+            uint64_t right = chunk->runLength[first + units];
+            unlink(pageAt(chunk, first + units), right);
+            units += right;
+        }
+        if (first > 1)
+        {
+            uint64_t left = chunk->runStart[first - 1];
+            uint64_t leftLength = chunk->runLength[left];
+            if (leftLength && left + leftLength == first)
+            {
+                unlink(pageAt(chunk, left), leftLength);
+                first = left;
+                units += leftLength;
+            }
+        }
+        // a run that reaches the unused end of the newest chunk goes back to it
+        if (reinterpret_cast<uint8_t *>(pageAt(chunk, first + units)) == bump)
+        {
+            bump = reinterpret_cast<uint8_t *>(pageAt(chunk, first));
+            return;
+        }
+        insertRun(pageAt(chunk, first), units);
+    }
+
+    // frees every page of the tree at once
+    void releaseAll()
+    {
+        while (chunks)
+        {
+            ChunkHeader *next = chunks->next;
+            Source::releaseChunk(chunks, chunkSize);
+            chunks = next;
+        }
+        std::fill(freeLists.begin(), freeLists.end(), nullptr);
+        std::fill(std::begin(nonEmpty), std::end(nonEmpty), 0);
+        bump = bumpEnd = nullptr;
+        chunkCount = usedUnits = 0;
+    }
+
+    uint64_t allocatedBytes() const { return chunkCount * chunkSize; }
+    uint64_t usedBytes() const { return usedUnits * unit; }
+
+private:
+    static ChunkHeader *chunkOf(const void *page)
+    {
+        return reinterpret_cast<ChunkHeader *>(reinterpret_cast<uintptr_t>(page) & ~(chunkSize - 1));
+    }
+    static uint64_t unitIn(const void *page) { return (reinterpret_cast<uintptr_t>(page) & (chunkSize - 1)) / unit; }
+    static FreePage *pageAt(ChunkHeader *chunk, uint64_t first)
+    {
+        return reinterpret_cast<FreePage *>(reinterpret_cast<uint8_t *>(chunk) + first * unit);
+    }
+
+    // the length of the shortest free run with at least units, chunkUnits if there is none
+    uint64_t shortestRun(uint64_t units) const
+    {
+        for (uint64_t word = units / 64; word < chunkUnits / 64; word++)
+        {
+            uint64_t bits = nonEmpty[word];
+            if (word == units / 64)
+                bits &= ~uint64_t(0) << (units % 64);
+            if (bits)
+                return word * 64 + __builtin_ctzll(bits);
+        }
+        return chunkUnits;
+    }
+
+    void insertRun(void *page, uint64_t units)
+    {
+        ChunkHeader *chunk = chunkOf(page);
+        uint64_t first = unitIn(page);
+        chunk->runLength[first] = units;
+        chunk->runStart[first + units - 1] = first;
+        FreePage *free = static_cast<FreePage *>(page);
+        free->prev = nullptr;
+        free->next = freeLists[units];
+        if (free->next)
+            free->next->prev = free;
+        freeLists[units] = free;
+        nonEmpty[units / 64] |= uint64_t(1) << (units % 64);
+    }
+
+    void unlink(FreePage *page, uint64_t units)
+    {
+        chunkOf(page)->runLength[unitIn(page)] = 0;
+        if (page->prev)
+            page->prev->next = page->next;
+        else
+            freeLists[units] = page->next;
+        if (page->next)
+            page->next->prev = page->prev;
+        if (!freeLists[units])
+            nonEmpty[units / 64] &= ~(uint64_t(1) << (units % 64));
+    }
+
+    void addChunk()
+    {
+        // the rest of the old chunk is kept as one free run
+        if (bump != bumpEnd)
+            insertRun(bump, (bumpEnd - bump) / unit);
+        uint8_t *chunk = static_cast<uint8_t *>(Source::allocateChunk(chunkSize));
+#ifdef MADV_HUGEPAGE
+        if (hugePages)
+            madvise(chunk, chunkSize, MADV_HUGEPAGE);
+#endif
+        ChunkHeader *header = reinterpret_cast<ChunkHeader *>(chunk);
+        std::fill(std::begin(header->runLength), std::end(header->runLength), 0);
+        std::fill(std::begin(header->runStart), std::end(header->runStart), 0);
+        header->owner = this;
+        header->next = chunks;
+        chunks = header;
+        chunkCount++;
+        bump = chunk + unit;
+        bumpEnd = chunk + chunkSize;
+    }
+};
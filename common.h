@@ -1 +0,0 @@
-extern bool cont;
\ No newline at end of file
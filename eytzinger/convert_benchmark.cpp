@@ -0,0 +1,115 @@
+// compares the recursive, copying eytzinger conversion of convert_playground.cpp
+// with the in place permutation of btree/eytzinger.hpp for every node size up to slotnum.
+// usage: convert_benchmark [repetitions], prints csv
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../btree/btree.hpp"
+
+using PageSlot = BTreeNode::PageSlot;
+
+// recursive versions, 1-indexed like convert_playground.cpp
+int eytzinger(const PageSlot *sortedArray, PageSlot *eytzingerArray, int n, int i = 0, int k = 1)
+{
+    if (k <= n)
+    {
+        i = eytzinger(sortedArray, eytzingerArray, n, i, 2 * k);
+        eytzingerArray[k] = sortedArray[i++];
+        i = eytzinger(sortedArray, eytzingerArray, n, i, 2 * k + 1);
+    }
+    return i;
+}
+
+void convertToEytzinger(PageSlot *sortedArray, int n)
+{
+    PageSlot *eytzingerArray = new PageSlot[n + 1];
+    eytzinger(sortedArray, eytzingerArray, n);
+    std::copy(eytzingerArray, eytzingerArray + n + 1, sortedArray);
+    delete[] eytzingerArray;
+}
+
+void fromEytzingerLayout(const PageSlot *eytzingerArray, PageSlot *sortedArray, int index, int &sortedIndex, int n)
+{
+    if (index >= n)
+        return;
+    fromEytzingerLayout(eytzingerArray, sortedArray, 2 * index, sortedIndex, n);
+    sortedArray[sortedIndex++] = eytzingerArray[index];
+    fromEytzingerLayout(eytzingerArray, sortedArray, 2 * index + 1, sortedIndex, n);
+}
+
+void convertFromEytzinger(PageSlot *eytzingerArray, int n)
+{
+    PageSlot *sortedArray = new PageSlot[n];
+    int sortedIndex = 0;
+    fromEytzingerLayout(eytzingerArray, sortedArray, 1, sortedIndex, n + 1);
+    std::copy(sortedArray, sortedArray + n, eytzingerArray);
+    delete[] sortedArray;
+}
+
+template <class Fn>
+double nsPerCall(unsigned reps, Fn fn)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned r = 0; r < reps; r++)
+        fn();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / reps;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned reps = argc > 1 ? atoi(argv[1]) : 2000;
+    const unsigned slotnum = BTreeNode::slotnum;
+    std::vector<PageSlot> sorted(slotnum), a(slotnum + 2), b(slotnum), c(slotnum);
+    for (unsigned i = 0; i < slotnum; i++)
+        sorted[i].head = i * 7;
+
+    std::cout << "n,recursive_to,inplace_to,direct_to,recursive_from,inplace_from" << std::endl;
+    for (unsigned n = 1; n <= slotnum; n++)
+    {
+        // both versions must agree before they are timed
+        std::copy(sorted.begin(), sorted.begin() + n, a.begin() + 1);
+        convertToEytzinger(a.data() + 1, n);
+        std::copy(sorted.begin(), sorted.begin() + n, b.begin());
+        toEytzingerInPlace<PageSlot, BTreeNode::slotnum>(b, n);
+        for (unsigned k = 1; k <= n; k++)
+            if (a[k + 1].head != b[k - 1].head || sorted[eytzingerToSorted(k, n)].head != b[k - 1].head || sortedToEytzinger(eytzingerToSorted(k, n), n) != k)
+            {
+                std::cout << "mismatch at n=" << n << " k=" << k << std::endl;
+                return 1;
+            }
+        bool levelsMatch = true;
+        forEachEytzinger(n, [&](unsigned k, unsigned r)
+                         { levelsMatch &= eytzingerToSorted(k, n) == r; });
+        if (!levelsMatch)
+        {
+            std::cout << "level walk mismatch at n=" << n << std::endl;
+            return 1;
+        }
+        fromEytzingerInPlace<PageSlot, BTreeNode::slotnum>(b, n);
+        for (unsigned i = 0; i < n; i++)
+            if (b[i].head != sorted[i].head)
+            {
+                std::cout << "round trip failed at n=" << n << " i=" << i << std::endl;
+                return 1;
+            }
+
+        double recTo = nsPerCall(reps, [&]
+                                 { convertToEytzinger(a.data(), n); });
+        double inTo = nsPerCall(reps, [&]
+                                { toEytzingerInPlace<PageSlot, BTreeNode::slotnum>(b, n); });
+        // what the inner node search index does: out of place, but every element is placed directly
+        double directTo = nsPerCall(reps, [&]
+                                    {
+                                        forEachEytzinger(n, [&](unsigned k, unsigned r)
+                                                         { c[k - 1] = sorted[r]; });
+                                        asm volatile("" ::"r"(c.data()) : "memory"); });
+        double recFrom = nsPerCall(reps, [&]
+                                   { convertFromEytzinger(a.data(), n); });
+        double inFrom = nsPerCall(reps, [&]
+                                  { fromEytzingerInPlace<PageSlot, BTreeNode::slotnum>(b, n); });
+        std::cout << n << "," << recTo << "," << inTo << "," << directTo << "," << recFrom << "," << inFrom << std::endl;
+    }
+    return 0;
+}
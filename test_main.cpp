@@ -1,6 +1,8 @@
 #include "tester_btree.hpp"
 #include "PerfEvent.hpp"
+#include "btree/key_encoding.hpp"
 #include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <fstream>
 #include <string>
@@ -10,63 +12,466 @@
 
 using namespace std;
 
+// height of the tree and number of inner and leaf pages below node
+template <class Node>
+unsigned treeShape(Node *node, uint64_t &innerPages, uint64_t &leafPages)
+{
+    if (!node->isInner())
+    {
+        leafPages++;
+        return 1;
+    }
+    innerPages++;
+    unsigned height = treeShape<Node>(node->upper, innerPages, leafPages);
+    for (unsigned i = 0; i < node->count; i++)
+        treeShape<Node>(node->getChild(i), innerPages, leafPages);
+    return height + 1;
+}
+
+// percentiles of the per operation latencies in ns
+void setLatencyParams(BenchmarkParameters &parameters, vector<uint64_t> &nanos)
+{
+    if (nanos.empty())
+        return;
+    sort(nanos.begin(), nanos.end());
+    auto at = [&](double q)
+    { return nanos[min<uint64_t>(nanos.size() * q, nanos.size() - 1)]; };
+    parameters.setParam("p50 ns", at(0.5));
+    parameters.setParam("p99 ns", at(0.99));
+    parameters.setParam("p99.9 ns", at(0.999));
+    parameters.setParam("p99.99 ns", at(0.9999));
+    parameters.setParam("max ns", nanos.back());
+}
+
+template <class Config = DefaultConfig>
 void runTest(vector<vector<uint8_t>> &keys, PerfEvent &perf)
 {
     // std::random_device rd;
     // std::mt19937 g(rd());
     // std::shuffle(keys.begin(), keys.end(), g);
-    Tester *t = new Tester();
+    TesterT<Config> *t = new TesterT<Config>();
+    auto params = [](const char *phase)
+    {
+        BenchmarkParameters p(phase);
+        p.setParam("slots", Config::Slots::name);
+        p.setParam("inner", Config::InnerLayout::name);
+        p.setParam("leaf", Config::LeafLayout::name);
+        p.setParam("pages", to_string(Config::innerPageSize) + "/" + to_string(Config::leafPageSize));
+        p.setParam("lengths", Config::Lengths::name);
+        p.setParam("children", Config::Addressing::name);
+        return p;
+    };
 
     std::vector<uint8_t> emptyKey{};
     uint64_t count = keys.size();
 
     {
-        PerfEventBlock peb(perf, count, {"insert"});
+        PerfEventBlock peb(perf, count, params("insert"));
+        // LATENCY=1 times every insert, the tail of the distribution are the inserts that split
+        bool latency = getenv("LATENCY");
+        vector<uint64_t> nanos;
         for (uint64_t i = 1; i < count; ++i)
         {
             // cout << i << endl;
+            if (!latency)
+            {
+                t->insert(keys[i], keys[i]);
+                continue;
+            }
+            auto start = chrono::steady_clock::now();
             t->insert(keys[i], keys[i]);
+            nanos.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
         }
+        if (latency)
+            setLatencyParams(peb.parameters, nanos);
+        uint64_t innerPages = 0, leafPages = 0;
+        peb.parameters.setParam("height", treeShape(t->btree->root, innerPages, leafPages));
+        peb.parameters.setParam("inner pages", innerPages);
+        // children per inner node, every page but the root has one parent
+        peb.parameters.setParam("fanout", innerPages ? to_string((innerPages + leafPages - 1) / innerPages) : "-");
+        // page memory of the tree, blob pages are not counted
+        uint64_t bytes = innerPages * Config::innerPageSize + leafPages * Config::leafPageSize;
+        peb.parameters.setParam("B/key", to_string(bytes / max<uint64_t>(count - 1, 1)));
     }
     string str(keys[count/2].begin(), keys[count/2].end()) ;
     // cout << string_to_hex(str) << endl;
     // t->btree->root->print0();
+    auto scanPhase = [&](const char *phase, bool reverse = false)
     {
-        PerfEventBlock peb(perf,count/5,{"scan"});
+        PerfEventBlock peb(perf,count/5,params(phase));
         for (uint64_t i = 0; i < count; i += 5) {
             // cout << i << endl;
             unsigned limit = 10;
-            t->scan(keys[i], [&](uint16_t, uint8_t *, uint16_t) {
+            auto callback = [&](uint16_t, uint8_t *, uint16_t) {
                 limit -= 1;
                 return limit > 0;
-            });
+            };
+            if (reverse)
+                t->scanReverse(keys[i], callback);
+            else
+                t->scan(keys[i], callback);
             // printf("SCAN SUCKS: %d\n",i);
         }
-    }
+    };
+    scanPhase("scan");
+    // the same starts, the 10 records at or before each key
+    scanPhase("scan reverse", true);
     // cout << t->scan_missed << endl;
     // cout << t->btree->root->count << endl;
 
     {
-        PerfEventBlock peb(perf, count, {"lookup"});
+        PerfEventBlock peb(perf, count, params("lookup"));
+        headStats = {};
         for (uint64_t i = 1; i < count; ++i)
         {
             // cout << i << endl;
 
             t->lookup(keys[i]);
         }
+#ifdef BTREE_HEAD_STATS
+        // share of the head comparisons that did not need the key rest
+        peb.parameters.setParam("head resolved", 1.0 - double(headStats.ties) / max<uint64_t>(headStats.compares, 1));
+#endif
+    }
+    {
+        PerfEventBlock peb(perf, count, params("lookup batch"));
+        t->lookupBatch(keys, 1, count);
+    }
+    {
+        // overwrites with values of the same size, keys[0] was never inserted and stays missing
+        PerfEventBlock peb(perf, count, params("update"));
+        for (uint64_t i = 0; i < count; ++i)
+            t->update(keys[i], keys[i]);
+    }
+    // DEFRAG=fill packs the leaves in 1ms steps and scans again
+    if (getenv("DEFRAG"))
+    {
+        {
+            PerfEventBlock peb(perf, count, params("defragment"));
+            peb.parameters.setParam("leaves before", btree_memory_usage(t->btree).levels[0].pages);
+            unsigned steps = 1;
+            while (!btree_defragment(t->btree, atof(getenv("DEFRAG")), std::chrono::microseconds(1000)))
+                steps++;
+            peb.parameters.setParam("leaves after", btree_memory_usage(t->btree).levels[0].pages);
+            peb.parameters.setParam("steps", steps);
+        }
+        scanPhase("scan defragmented");
     }
     {
-        PerfEventBlock peb(perf, count, {"remove"});
+        PerfEventBlock peb(perf, count, params("remove"));
         for (uint64_t i = 1; i < count; ++i)
         {
             // cout << i << endl;
             t->remove(keys[i]);
         }
+        // merged away nodes are freed and the root collapses, an emptied tree is one leaf again
+        MemoryUsage usage = btree_memory_usage(t->btree);
+        uint64_t pagesLeft = 0;
+        for (LevelMemory &level : usage.levels)
+            pagesLeft += level.pages;
+        peb.parameters.setParam("pages left", pagesLeft);
+        peb.parameters.setParam("height", usage.levels.size());
     }
     // cout << "The missed removes: " << t->count / ((1.0)*count) << endl;
     // cout << "Mssed: " << t->count << endl;
     // cout << "Times: " << t->btree->root->get_times() << endl;
-    t->~Tester();
+    t->~TesterT();
+}
+
+// PAGES=1 reruns a workload with the page sizes of the sweep configs
+void runPageSweep(vector<vector<uint8_t>> &keys, PerfEvent &perf)
+{
+    if (!getenv("PAGES"))
+        return;
+    runTest<Pages8K>(keys, perf);
+    runTest<Pages16K>(keys, perf);
+    runTest<Pages32K>(keys, perf);
+    runTest<Pages64K>(keys, perf);
+    runTest<Inner4KLeaf16K>(keys, perf);
+    runTest<Inner4KLeaf64K>(keys, perf);
+}
+
+/**
+ * @brief BLOB=n: n INT keys with values from 100 bytes to 1MB, most of them on
+ * blob pages. every value is a slice of one pattern, so lookups and scans can
+ * check the bytes they get back
+ */
+template <class Config = DefaultConfig>
+void runBlobTest(uint64_t n, PerfEvent &perf)
+{
+    static const uint64_t sizes[] = {100, 300, 700, 2000, 5000, 20000, 70000, 150000};
+    auto valueSize = [](uint64_t i)
+    { return i % 64 == 63 ? uint64_t(1) << 20 : sizes[i % 8]; };
+    vector<uint8_t> pattern((1 << 20) + 256);
+    for (size_t j = 0; j < pattern.size(); j++)
+        pattern[j] = j * 7;
+    vector<vector<uint8_t>> keys;
+    uint64_t totalBytes = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        keys.push_back(encodeKey(uint32_t(i)));
+        totalBytes += valueSize(i);
+    }
+    auto params = [&](const char *phase)
+    {
+        BenchmarkParameters p(phase);
+        p.setParam("slots", Config::Slots::name);
+        p.setParam("value MB", totalBytes >> 20);
+        return p;
+    };
+
+    BTreeT<Config> *tree = btree_create<Config>();
+    {
+        PerfEventBlock peb(perf, n, params("blob insert"));
+        for (uint64_t i = 0; i < n; i++)
+            btree_insert(tree, keys[i].data(), keys[i].size(), pattern.data() + i % 251, valueSize(i));
+    }
+    {
+        PerfEventBlock peb(perf, n, params("blob lookup"));
+        vector<uint8_t> buffer(1 << 20);
+        for (uint64_t i = 0; i < n; i++)
+        {
+            uint64_t length = 0;
+            bool found = btree_lookup_into(tree, keys[i].data(), keys[i].size(), buffer.data(), buffer.size(), length);
+            if (!found || length != valueSize(i) || memcmp(buffer.data(), pattern.data() + i % 251, length) != 0)
+                throw std::logic_error("blob lookup returned a wrong value");
+        }
+    }
+    {
+        PerfEventBlock peb(perf, n, params("blob scan"));
+        uint8_t keyOut[16];
+        uint64_t i = 0, scannedBytes = 0;
+        btree_scan<Config>(tree, keys[0].data(), keys[0].size(), keyOut, [&](unsigned, const ValueView &value)
+                           {
+                               uint64_t offset = 0;
+                               value.forEachChunk([&](uint8_t *chunk, uint64_t chunkLength)
+                                                  {
+                                                      if (memcmp(chunk, pattern.data() + i % 251 + offset, chunkLength) != 0)
+                                                          throw std::logic_error("blob scan returned a wrong value");
+                                                      offset += chunkLength; });
+                               scannedBytes += offset;
+                               i++;
+                               return true; });
+        if (i != n || scannedBytes != totalBytes)
+            throw std::logic_error("blob scan missed records");
+    }
+    {
+        PerfEventBlock peb(perf, n, params("blob remove"));
+        for (uint64_t i = 0; i < n; i++)
+            if (!btree_remove(tree, keys[i].data(), keys[i].size()))
+                throw std::logic_error("blob remove missed a record");
+    }
+    btree_destroy(tree);
+}
+
+/**
+ * @brief BULK=fill: loads the sorted keys with btree_insert, in sorted batches and with
+ * btree_bulk_load packed to fill. the value of a key is the key repeated repeat times, long enough
+ * for blobs with a large repeat. the batched tree is checked and emptied with range removes, the
+ * bulk loaded one is checked key by key and emptied with single removes
+ */
+template <class Config = DefaultConfig>
+void runBulkTest(vector<vector<uint8_t>> keys, PerfEvent &perf, unsigned repeat = 1)
+{
+    double fill = atof(getenv("BULK"));
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    // btree_insert skips empty keys
+    if (!keys.empty() && keys[0].empty())
+        keys.erase(keys.begin());
+    uint64_t n = keys.size();
+    vector<vector<uint8_t>> values(n);
+    for (uint64_t i = 0; i < n; i++)
+        for (unsigned r = 0; r < repeat; r++)
+            values[i].insert(values[i].end(), keys[i].begin(), keys[i].end());
+    auto params = [&](const char *phase)
+    {
+        BenchmarkParameters p(phase);
+        p.setParam("slots", Config::Slots::name);
+        p.setParam("fill", fill);
+        p.setParam("repeat", repeat);
+        return p;
+    };
+    // a long value is a blob without inline data, it is compared through a copy
+    vector<uint8_t> copy;
+    auto sameValue = [&](const ValueView &value, const vector<uint8_t> &expected)
+    {
+        if (value.length != expected.size())
+            return false;
+        copy.resize(value.length);
+        value.copyTo(copy.data());
+        return copy == expected;
+    };
+    auto setShape = [&](BenchmarkParameters &p, BTreeT<Config> *tree)
+    {
+        MemoryUsage usage = btree_memory_usage(tree);
+        uint64_t bytes = 0;
+        for (LevelMemory &level : usage.levels)
+            bytes += level.bytes;
+        p.setParam("height", usage.levels.size());
+        p.setParam("B/key", to_string(bytes / max<uint64_t>(n, 1)));
+    };
+
+    BTreeT<Config> *loop = btree_create<Config>();
+    {
+        PerfEventBlock peb(perf, n, params("insert loop"));
+        for (uint64_t i = 0; i < n; i++)
+            btree_insert(loop, keys[i].data(), keys[i].size(), values[i].data(), values[i].size());
+        setShape(peb.parameters, loop);
+    }
+    btree_destroy(loop);
+
+    // the same sorted keys in micro batches that keep the descent path
+    BTreeT<Config> *batched = btree_create<Config>();
+    {
+        PerfEventBlock peb(perf, n, params("sorted batch"));
+        constexpr unsigned batch = 256;
+        vector<uint8_t *> keyPointers(batch), valuePointers(batch);
+        vector<uint16_t> keyLengths(batch);
+        vector<uint64_t> valueLengths(batch);
+        for (uint64_t begin = 0; begin < n; begin += batch)
+        {
+            unsigned count = min<uint64_t>(batch, n - begin);
+            for (unsigned i = 0; i < count; i++)
+            {
+                keyPointers[i] = keys[begin + i].data();
+                keyLengths[i] = keys[begin + i].size();
+                valuePointers[i] = values[begin + i].data();
+                valueLengths[i] = values[begin + i].size();
+            }
+            btree_insert_sorted_batch(batched, keyPointers.data(), keyLengths.data(), valuePointers.data(), valueLengths.data(), count);
+        }
+        setShape(peb.parameters, batched);
+    }
+    for (uint64_t i = 0; i < n; i++)
+    {
+        ValueView value;
+        if (!btree_lookup_view(batched, keys[i].data(), keys[i].size(), value) || !sameValue(value, values[i]))
+            throw std::logic_error("sorted batch returned a wrong value");
+    }
+    {
+        // retention: drops the oldest keys a span at a time, the last span ends after the last key
+        PerfEventBlock peb(perf, n, params("remove range"));
+        constexpr uint64_t span = 4096;
+        for (uint64_t begin = 0; begin < n; begin += span)
+        {
+            vector<uint8_t> hi = begin + span < n ? keys[begin + span] : keys.back();
+            if (begin + span >= n)
+                hi.push_back(0);
+            uint64_t count = min(span, n - begin);
+            if (btree_remove_range(batched, keys[begin].data(), keys[begin].size(), hi.data(), hi.size()) != count)
+                throw std::logic_error("remove range missed records");
+        }
+        MemoryUsage usage = btree_memory_usage(batched);
+        peb.parameters.setParam("pages left", usage.levels[0].pages);
+    }
+    btree_destroy(batched);
+
+    BTreeT<Config> *tree = btree_create<Config>();
+    {
+        PerfEventBlock peb(perf, n, params("bulk load"));
+        uint64_t i = 0;
+        btree_bulk_load<Config>(tree, [&](BulkRecord &record)
+                                {
+                                    if (i == n)
+                                        return false;
+                                    record = {keys[i].data(), uint16_t(keys[i].size()), values[i].data(), values[i].size()};
+                                    i++;
+                                    return true; },
+                                fill);
+        setShape(peb.parameters, tree);
+    }
+    {
+        PerfEventBlock peb(perf, n, params("bulk lookup"));
+        for (uint64_t i = 0; i < n; i++)
+        {
+            ValueView value;
+            if (!btree_lookup_view(tree, keys[i].data(), keys[i].size(), value) || !sameValue(value, values[i]))
+                throw std::logic_error("bulk loaded tree returned a wrong value");
+        }
+    }
+    {
+        PerfEventBlock peb(perf, n, params("bulk remove"));
+        for (auto &key : keys)
+            if (!btree_remove(tree, key.data(), key.size()))
+                throw std::logic_error("bulk loaded tree missed a record");
+    }
+    btree_destroy(tree);
+}
+
+/**
+ * @brief COUNTS=1: inserts and removes the keys with and without subtree counts for the cost of
+ * keeping them, then checks rank, select and range counts of the counted tree against the sorted keys
+ */
+template <class Config = DefaultConfig>
+void runCountTest(vector<vector<uint8_t>> keys, PerfEvent &perf)
+{
+    if (!keys.empty() && keys[0].empty())
+        keys.erase(keys.begin());
+    auto params = [](const char *phase, const char *counts = "yes")
+    {
+        BenchmarkParameters p(phase);
+        p.setParam("slots", Config::Slots::name);
+        p.setParam("counts", counts);
+        return p;
+    };
+    // the same workload on a tree of each config, the tree is filled again afterwards
+    auto insertRemove = [&](auto *tree, const char *counts)
+    {
+        {
+            PerfEventBlock peb(perf, keys.size(), params("insert", counts));
+            for (auto &key : keys)
+                btree_insert(tree, key.data(), key.size(), key.data(), key.size());
+        }
+        {
+            PerfEventBlock peb(perf, keys.size(), params("remove", counts));
+            for (auto &key : keys)
+                btree_remove(tree, key.data(), key.size());
+        }
+        for (auto &key : keys)
+            btree_insert(tree, key.data(), key.size(), key.data(), key.size());
+    };
+    BTreeT<Config> *plain = btree_create<Config>();
+    insertRemove(plain, "no");
+    btree_destroy(plain);
+    BTreeT<CountedConfig> *tree = btree_create<CountedConfig>();
+    insertRemove(tree, "yes");
+
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    uint64_t n = keys.size();
+    {
+        PerfEventBlock peb(perf, n, params("rank"));
+        for (uint64_t i = 0; i < n; i++)
+            if (btree_rank(tree, keys[i].data(), keys[i].size()) != i)
+                throw std::logic_error("rank does not match the sorted keys");
+    }
+    {
+        PerfEventBlock peb(perf, n, params("select"));
+        BTreeCursorT<CountedConfig> cursor(tree);
+        vector<uint8_t> keyOut(1 << 16);
+        for (uint64_t i = 0; i < n; i++)
+            if (!btree_select(tree, i, cursor) || cursor.key(keyOut.data()) != keys[i].size() ||
+                memcmp(keyOut.data(), keys[i].data(), keys[i].size()) != 0)
+                throw std::logic_error("select does not match the sorted keys");
+    }
+    {
+        // pages of 100 records from every key on
+        PerfEventBlock peb(perf, n, params("count range"));
+        for (uint64_t i = 0; i + 100 < n; i++)
+            if (btree_count_range(tree, keys[i].data(), keys[i].size(), keys[i + 100].data(), keys[i + 100].size()) != 100)
+                throw std::logic_error("count range does not match the sorted keys");
+    }
+    btree_destroy(tree);
+}
+
+// LENGTHS=1 reruns a workload with the other payload length formats of the leaves
+void runLengthSweep(vector<vector<uint8_t>> &keys, PerfEvent &perf)
+{
+    if (!getenv("LENGTHS"))
+        return;
+    runTest<LengthConfig<WideLengths>>(keys, perf);
+    runTest<LengthConfig<VarintLengths>>(keys, perf);
 }
 
 std::vector<uint8_t> stringToVector(const std::string &str)
@@ -78,6 +483,9 @@ int main()
 {
     srand(42);
     PerfEvent perf;
+    // HUGEPAGES=0 leaves the chunks of the trees on 4KB pages
+    if (getenv("HUGEPAGES"))
+        PageAllocatorBase::hugePages = atoi(getenv("HUGEPAGES"));
     if (getenv("INT"))
     {
         vector<vector<uint8_t>> data;
@@ -86,16 +494,24 @@ int main()
         for (uint64_t i = 0; i < n; i++)
             v.push_back(i);
         for (auto x : v)
+            data.push_back(encodeKey(uint32_t(x)));
+        runTest<DefaultConfig>(data, perf);
+        runTest<NodeIdConfig>(data, perf);
+        runTest<SimdConfig>(data, perf);
+        runTest<FixedKey<uint32_t>>(data, perf);
+        if (getenv("BULK"))
         {
-            union
-            {
-                uint32_t x;
-                uint8_t bytes[4];
-            } u;
-            u.x = x;
-            data.emplace_back(u.bytes, u.bytes + 4);
+            runBulkTest<DefaultConfig>(data, perf);
+            runBulkTest<SimdConfig>(data, perf);
+            runBulkTest<FixedKey<uint32_t>>(data, perf);
         }
-        runTest(data, perf);
+        runPageSweep(data, perf);
+        runLengthSweep(data, perf);
+        if (getenv("COUNTS"))
+            runCountTest(data, perf);
+        // the INT values are the 4 byte keys
+        if (getenv("LENGTHS"))
+            runTest<LengthConfig<FixedLengths<4>>>(data, perf);
     }
 
     if (getenv("LONG1"))
@@ -125,6 +541,41 @@ int main()
             data.push_back(stringToVector(s));
         }
         runTest(data, perf);
+        runPageSweep(data, perf);
+        if (getenv("BULK"))
+        {
+            runBulkTest(data, perf);
+            // 8 copies of a key longer than 64 bytes are above blobThreshold of 4KB leaves
+            runBulkTest(data, perf, 8);
+        }
+    }
+
+    // (int32, double, string) tuples, shuffled so the byte order has to come from the encoding
+    if (getenv("COMPOSITE"))
+    {
+        vector<vector<uint8_t>> data;
+        uint64_t n = atof(getenv("COMPOSITE"));
+        for (uint64_t i = 0; i < n; i++)
+        {
+            int32_t a = int32_t(random() % 1000) - 500;
+            double b = (double(random()) - RAND_MAX / 2) / 1e3;
+            string c(random() % 8, 'a' + random() % 4);
+            KeyEncoder enc;
+            enc.addTuple(make_tuple(a, b, c));
+            KeyDecoder dec(enc.data(), enc.size());
+            auto back = dec.getTuple<int32_t, double, string>();
+            assert(back == make_tuple(a, b, c) && dec.done());
+            static_cast<void>(back);
+            data.push_back(enc.bytes);
+        }
+        runTest<DefaultConfig>(data, perf);
+        runTest<SimdConfig>(data, perf);
+    }
+
+    if (getenv("BLOB"))
+    {
+        runBlobTest<DefaultConfig>(atof(getenv("BLOB")), perf);
+        runBlobTest<SimdConfig>(atof(getenv("BLOB")), perf);
     }
 
     if (getenv("FILE"))
@@ -135,7 +586,18 @@ int main()
         while (getline(in, line))
             data.push_back(stringToVector(line));
         ;
-        runTest(data, perf);
+        runTest<DefaultConfig>(data, perf);
+        runTest<WideHeadConfig>(data, perf);
+        runTest<SimdConfig>(data, perf);
+        runPageSweep(data, perf);
+        runLengthSweep(data, perf);
+        if (getenv("COUNTS"))
+            runCountTest(data, perf);
+        if (getenv("BULK"))
+        {
+            runBulkTest<DefaultConfig>(data, perf);
+            runBulkTest<SimdConfig>(data, perf);
+        }
     }
 
     return 0;
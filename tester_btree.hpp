@@ -6,6 +6,7 @@
 #include "btree/btree.hpp"
 #include <cassert>
 #include <cstring>
+#include <iterator>
 #include <map>
 #include <vector>
 #include <cstdlib>
@@ -23,14 +24,15 @@ std::string string_to_hex(const std::string& input)
     }
     return output;
 }
-struct Tester
+template <class Config>
+struct TesterT
 {
-    BTree *btree;
+    BTreeT<Config> *btree;
     std::map<std::vector<uint8_t>, std::vector<uint8_t>> stdMap;
 
-    Tester() : btree(btree_create()), stdMap() {}
+    TesterT() : btree(btree_create<Config>()), stdMap() {}
 
-    ~Tester() { btree_destroy(btree); }
+    ~TesterT() { btree_destroy(btree); }
 
     void insert(std::vector<uint8_t> &key, std::vector<uint8_t> &value)
     {
@@ -41,29 +43,92 @@ struct Tester
         btree_insert(btree, key.data(), key.size(), value.data(), value.size());
     }
 
+    // update only, a missing key is not inserted
+    void update(std::vector<uint8_t> &key, std::vector<uint8_t> &value)
+    {
+        bool updated = btree_update(btree, key.data(), key.size(), value.data(), value.size());
+#ifndef NDEBUG
+        auto it = stdMap.find(key);
+        assert(updated == (it != stdMap.end()));
+        if (updated)
+            it->second = value;
+#endif
+        (void)updated;
+    }
+
     void lookup(std::vector<uint8_t> &key)
     {
-        uint16_t lenOut = 0;
-        uint8_t *value = btree_lookup(btree, key.data(), key.size(), lenOut);
+        ValueView value;
+        bool found = btree_lookup_view(btree, key.data(), key.size(), value);
 #ifdef NDEBUG
-        if (lenOut != key.size() || (lenOut > 0 && value[0] != key[0]))
+        if (!found || value.length != key.size() || (value.length > 0 && !value.isBlob() && value.data[0] != key[0]))
             throw;
 #else
         auto it = stdMap.find(key);
         if (it == stdMap.end())
         {
-            assert(value == nullptr);
+            assert(!found);
         }
         else
         {
-            assert(value != nullptr);
-            assert(lenOut == it->second.size());
-            if (lenOut > 0)
-                assert(memcmp(value, it->second.data(), lenOut) == 0);
+            assert(found);
+            assert(value.length == it->second.size());
+            std::vector<uint8_t> copy(value.length);
+            value.copyTo(copy.data());
+            assert(copy == it->second);
         }
 #endif
     }
 
+    // looks up keys [begin, end) with btree_lookup_batch, batch keys per call
+    void lookupBatch(std::vector<std::vector<uint8_t>> &keys, uint64_t begin, uint64_t end, unsigned batch = 64)
+    {
+        std::vector<uint8_t *> keyPointers(batch);
+        std::vector<uint16_t> keyLengths(batch);
+        std::vector<ValueView> values(batch);
+        for (; begin < end; begin += batch)
+        {
+            unsigned n = std::min<uint64_t>(batch, end - begin);
+            for (unsigned i = 0; i < n; i++)
+            {
+                keyPointers[i] = keys[begin + i].data();
+                keyLengths[i] = keys[begin + i].size();
+            }
+            unsigned found = btree_lookup_batch(btree, keyPointers.data(), keyLengths.data(), n, values.data());
+#ifdef NDEBUG
+            if (found != n)
+                throw;
+#endif
+            unsigned present = 0;
+            for (unsigned i = 0; i < n; i++)
+            {
+                std::vector<uint8_t> &key = keys[begin + i];
+                ValueView &value = values[i];
+#ifdef NDEBUG
+                if (value.length != key.size() || (value.length > 0 && !value.isBlob() && value.data[0] != key[0]))
+                    throw;
+#else
+                auto it = stdMap.find(key);
+                if (it == stdMap.end())
+                {
+                    assert(!value.data && !value.blob);
+                }
+                else
+                {
+                    present++;
+                    assert(value.length == it->second.size());
+                    std::vector<uint8_t> copy(value.length);
+                    value.copyTo(copy.data());
+                    assert(copy == it->second);
+                }
+#endif
+            }
+            assert(found == present);
+            (void)found;
+            (void)present;
+        }
+    }
+
     void remove(std::vector<uint8_t> &key)
     {
         bool wasPresentBtree = btree_remove(btree, key.data(), key.size());
@@ -121,8 +186,53 @@ struct Tester
             
             assert(std_iterator == stdMap.end());
         }
+#endif
+    }
+
+    // scan from the last record <= key downward, checked against stdMap in reverse
+    void scanReverse(std::vector<uint8_t> &key,
+                     const std::function<bool(uint16_t, uint8_t *, uint16_t)>
+                         &found_record_cb)
+    {
+        if (getenv("NO_SCAN"))
+        {
+            return;
+        }
+        uint8_t keyOut[1 << 10];
+        bool shouldContinue = true;
+#ifndef NDEBUG
+        auto std_iterator = std::make_reverse_iterator(stdMap.upper_bound(key));
+#endif
+        btree_scan_reverse(
+            btree, key.data(), key.size(), keyOut,
+            [&](unsigned keyLen, uint8_t *payload, unsigned payloadLen)
+            {
+#ifdef NDEBUG
+                if (keyLen != payloadLen || (payloadLen > 0 && payload[0] != keyOut[0]))
+                    throw;
+#else
+                assert(shouldContinue);
+                assert(std_iterator != stdMap.rend());
+                assert(std_iterator->first.size() == keyLen);
+                if (keyLen)
+                    assert(memcmp(std_iterator->first.data(), keyOut, keyLen) == 0);
+                assert(std_iterator->second.size() == payloadLen);
+                if (payloadLen)
+                    assert(memcmp(std_iterator->second.data(), payload, payloadLen) == 0);
+                ++std_iterator;
+#endif
+                shouldContinue = found_record_cb(keyLen, payload, payloadLen);
+                return shouldContinue;
+            });
+#ifndef NDEBUG
+        if (shouldContinue)
+        {
+            assert(std_iterator == stdMap.rend());
+        }
 #endif
     }
 };
 
+using Tester = TesterT<DefaultConfig>;
+
 #endif // DSE_PRACTICAL_COURSE_BTREE_TEMPLATE_TESTER_HPP